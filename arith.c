@@ -0,0 +1,391 @@
+#include "./arith.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./vars.h"
+
+#define MAX_NAME 256
+#define MAX_DEPTH 32  // variables whose values refer to other variables
+
+struct arith {
+    const char *cur;
+    const char *end;
+    int evaluate;  // 0 in the branch of && || ?: that is skipped
+    int failed;
+};
+typedef struct arith arith_t;
+
+static int depth = 0;
+
+static long long parse_ternary(arith_t *a);
+
+/* prints an error about the expression, once */
+static void arith_error(arith_t *a, const char *msg) {
+    if (!a->failed) {
+        fprintf(stderr, "arithmetic: %s \n", msg);
+        a->failed = 1;
+    }
+}
+
+static void skip_space(arith_t *a) {
+    while (a->cur < a->end &&
+           (*a->cur == ' ' || *a->cur == '\t' || *a->cur == '\n')) {
+        a->cur++;
+    }
+}
+
+/*
+ * consumes op if it is next and is not the start of a longer operator
+ * (one of the characters in not_after follows it), returns 1 if it was
+ */
+static int accept(arith_t *a, const char *op, const char *not_after) {
+    skip_space(a);
+    size_t len = strlen(op);
+    if ((size_t)(a->end - a->cur) < len || strncmp(a->cur, op, len) != 0) {
+        return 0;
+    }
+    if (a->cur + len < a->end && not_after != NULL &&
+        strchr(not_after, a->cur[len]) != NULL) {
+        return 0;
+    }
+    a->cur += len;
+    return 1;
+}
+
+static int is_name_char(char c, int first) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (!first && c >= '0' && c <= '9');
+}
+
+/* parses a decimal, 0x hex or 0 octal constant */
+static long long parse_number(arith_t *a) {
+    unsigned long long value = 0;
+    unsigned base = 10;
+    if (*a->cur == '0' && a->cur + 1 < a->end &&
+        (a->cur[1] == 'x' || a->cur[1] == 'X')) {
+        base = 16;
+        a->cur += 2;
+    } else if (*a->cur == '0') {
+        base = 8;
+    }
+
+    int digits = 0;
+    while (a->cur < a->end) {
+        char c = *a->cur;
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = (unsigned)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (unsigned)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (unsigned)(c - 'A' + 10);
+        } else if (is_name_char(c, 0)) {
+            digit = base;  // a letter that is not a digit is an error
+        } else {
+            break;
+        }
+        if (digit >= base) {
+            arith_error(a, "invalid number");
+            return 0;
+        }
+        value = value * base + digit;
+        digits++;
+        a->cur++;
+    }
+    if (digits == 0 && base == 16) {
+        arith_error(a, "invalid number");
+    }
+    return (long long)value;
+}
+
+/* the value of a variable, itself evaluated as an expression */
+static long long variable_value(arith_t *a, const char *name) {
+    const char *value = get_var(name);
+    if (value == NULL || value[0] == '\0') {
+        return 0;
+    }
+    if (depth >= MAX_DEPTH) {
+        arith_error(a, "expression recursion level exceeded");
+        return 0;
+    }
+    long long result = 0;
+    depth++;
+    if (eval_arith(value, strlen(value), &result) == -1) {
+        a->failed = 1;
+    }
+    depth--;
+    return result;
+}
+
+/* applies a binary operator, a division by zero is an error */
+static long long apply(arith_t *a, const char *op, long long x, long long y) {
+    unsigned long long ux = (unsigned long long)x;
+    unsigned long long uy = (unsigned long long)y;
+
+    // + - * << are done unsigned so that overflow wraps instead of being
+    // undefined
+    switch (op[0]) {
+        case '+':
+            return (long long)(ux + uy);
+        case '-':
+            return (long long)(ux - uy);
+        case '*':
+            return (long long)(ux * uy);
+        case '/':
+        case '%':
+            if (y == 0) {
+                if (a->evaluate) {
+                    arith_error(a, "division by zero");
+                }
+                return 0;
+            }
+            if (x == LLONG_MIN && y == -1) {
+                return op[0] == '/' ? LLONG_MIN : 0;
+            }
+            return op[0] == '/' ? x / y : x % y;
+        case '<':
+            return (long long)(ux << (uy & 63));
+        case '>':
+            return x >> (y & 63);
+        case '&':
+            return x & y;
+        case '^':
+            return x ^ y;
+        case '|':
+            return x | y;
+    }
+    return 0;
+}
+
+/* a number, a variable (maybe assigned to) or a parenthesized expression */
+static long long parse_primary(arith_t *a) {
+    skip_space(a);
+    if (a->cur >= a->end) {
+        arith_error(a, "syntax error: operand expected");
+        return 0;
+    }
+
+    if (*a->cur == '(') {
+        a->cur++;
+        long long value = parse_ternary(a);
+        if (!accept(a, ")", NULL)) {
+            arith_error(a, "syntax error: missing )");
+        }
+        return value;
+    }
+    if (*a->cur >= '0' && *a->cur <= '9') {
+        return parse_number(a);
+    }
+
+    // NAME, $NAME or ${NAME}
+    int braced = 0;
+    if (*a->cur == '$') {
+        a->cur++;
+        if (a->cur < a->end && *a->cur == '{') {
+            braced = 1;
+            a->cur++;
+        }
+    }
+    char name[MAX_NAME];
+    size_t len = 0;
+    while (a->cur < a->end && is_name_char(*a->cur, len == 0)) {
+        if (len + 1 < sizeof(name)) {
+            name[len++] = *a->cur;
+        }
+        a->cur++;
+    }
+    name[len] = '\0';
+    if (len == 0 || (braced && !accept(a, "}", NULL))) {
+        arith_error(a, "syntax error: operand expected");
+        return 0;
+    }
+
+    static const char *assign_ops[] = {"<<=", ">>=", "+=", "-=", "*=", "/=",
+                                       "%=",  "&=",  "^=", "|=", "="};
+    for (size_t i = 0; i < sizeof(assign_ops) / sizeof(assign_ops[0]); i++) {
+        if (accept(a, assign_ops[i], "=")) {
+            long long value = parse_ternary(a);
+            if (assign_ops[i][0] != '=') {
+                value = apply(a, assign_ops[i], variable_value(a, name), value);
+            }
+            if (a->evaluate && !a->failed) {
+                char number[32];
+                snprintf(number, sizeof(number), "%lld", value);
+                set_var(name, number);
+            }
+            return value;
+        }
+    }
+    return variable_value(a, name);
+}
+
+static long long parse_unary(arith_t *a) {
+    if (accept(a, "!", "=")) {
+        return !parse_unary(a);
+    } else if (accept(a, "~", NULL)) {
+        return ~parse_unary(a);
+    } else if (accept(a, "-", "-=")) {
+        return (long long)(0ULL - (unsigned long long)parse_unary(a));
+    } else if (accept(a, "+", "+=")) {
+        return parse_unary(a);
+    }
+    return parse_primary(a);
+}
+
+static long long parse_mul(arith_t *a) {
+    long long value = parse_unary(a);
+    while (1) {
+        if (accept(a, "*", "=")) {
+            value = apply(a, "*", value, parse_unary(a));
+        } else if (accept(a, "/", "=")) {
+            value = apply(a, "/", value, parse_unary(a));
+        } else if (accept(a, "%", "=")) {
+            value = apply(a, "%", value, parse_unary(a));
+        } else {
+            return value;
+        }
+    }
+}
+
+static long long parse_add(arith_t *a) {
+    long long value = parse_mul(a);
+    while (1) {
+        if (accept(a, "+", "=")) {
+            value = apply(a, "+", value, parse_mul(a));
+        } else if (accept(a, "-", "=")) {
+            value = apply(a, "-", value, parse_mul(a));
+        } else {
+            return value;
+        }
+    }
+}
+
+static long long parse_shift(arith_t *a) {
+    long long value = parse_add(a);
+    while (1) {
+        if (accept(a, "<<", "=")) {
+            value = apply(a, "<", value, parse_add(a));
+        } else if (accept(a, ">>", "=")) {
+            value = apply(a, ">", value, parse_add(a));
+        } else {
+            return value;
+        }
+    }
+}
+
+static long long parse_compare(arith_t *a) {
+    long long value = parse_shift(a);
+    while (1) {
+        if (accept(a, "<=", NULL)) {
+            value = value <= parse_shift(a);
+        } else if (accept(a, ">=", NULL)) {
+            value = value >= parse_shift(a);
+        } else if (accept(a, "<", "<=")) {
+            value = value < parse_shift(a);
+        } else if (accept(a, ">", ">=")) {
+            value = value > parse_shift(a);
+        } else {
+            return value;
+        }
+    }
+}
+
+static long long parse_equality(arith_t *a) {
+    long long value = parse_compare(a);
+    while (1) {
+        if (accept(a, "==", NULL)) {
+            value = value == parse_compare(a);
+        } else if (accept(a, "!=", NULL)) {
+            value = value != parse_compare(a);
+        } else {
+            return value;
+        }
+    }
+}
+
+static long long parse_bit_and(arith_t *a) {
+    long long value = parse_equality(a);
+    while (accept(a, "&", "&=")) {
+        value &= parse_equality(a);
+    }
+    return value;
+}
+
+static long long parse_bit_xor(arith_t *a) {
+    long long value = parse_bit_and(a);
+    while (accept(a, "^", "=")) {
+        value ^= parse_bit_and(a);
+    }
+    return value;
+}
+
+static long long parse_bit_or(arith_t *a) {
+    long long value = parse_bit_xor(a);
+    while (accept(a, "|", "|=")) {
+        value |= parse_bit_xor(a);
+    }
+    return value;
+}
+
+static long long parse_and(arith_t *a) {
+    long long value = parse_bit_or(a);
+    while (accept(a, "&&", NULL)) {
+        // the right side is parsed but not evaluated when it cannot matter
+        int evaluate = a->evaluate;
+        a->evaluate = evaluate && value;
+        long long right = parse_bit_or(a);
+        a->evaluate = evaluate;
+        value = value && right;
+    }
+    return value;
+}
+
+static long long parse_or(arith_t *a) {
+    long long value = parse_and(a);
+    while (accept(a, "||", NULL)) {
+        int evaluate = a->evaluate;
+        a->evaluate = evaluate && !value;
+        long long right = parse_and(a);
+        a->evaluate = evaluate;
+        value = value || right;
+    }
+    return value;
+}
+
+static long long parse_ternary(arith_t *a) {
+    long long cond = parse_or(a);
+    if (!accept(a, "?", NULL)) {
+        return cond;
+    }
+
+    int evaluate = a->evaluate;
+    a->evaluate = evaluate && cond;
+    long long if_true = parse_ternary(a);
+    if (!accept(a, ":", NULL)) {
+        arith_error(a, "syntax error: missing :");
+    }
+    a->evaluate = evaluate && !cond;
+    long long if_false = parse_ternary(a);
+    a->evaluate = evaluate;
+    return cond ? if_true : if_false;
+}
+
+/* evaluates the first len bytes of expr into *result,
+        returns 0 on success, -1 after printing an error */
+int eval_arith(const char *expr, size_t len, long long *result) {
+    arith_t a = {expr, expr + len, 1, 0};
+
+    skip_space(&a);
+    if (a.cur == a.end) {
+        // $(( )) is 0
+        *result = 0;
+        return 0;
+    }
+    *result = parse_ternary(&a);
+    skip_space(&a);
+    if (!a.failed && a.cur != a.end) {
+        arith_error(&a, "syntax error: invalid operator");
+    }
+    return a.failed ? -1 : 0;
+}
@@ -0,0 +1,18 @@
+#ifndef ARITH_H_
+#define ARITH_H_
+
+#include <stddef.h>
+
+/*
+ * evaluation of $(( )) arithmetic with 64-bit signed integers, like C:
+ * + - * / % << >> < <= > >= == != & ^ | && || ! ~ ?: and parentheses,
+ * numbers in decimal, 0x hex or 0 octal, and variables (NAME, $NAME or
+ * ${NAME}, unset or empty is 0) which can be assigned with = += -= *= /= %=
+ * <<= >>= &= ^= |=. Overflow wraps around.
+ */
+
+/* evaluates the first len bytes of expr into *result,
+        returns 0 on success, -1 after printing an error */
+int eval_arith(const char *expr, size_t len, long long *result);
+
+#endif  // ARITH_H_
@@ -0,0 +1,570 @@
+/*
+ * microbenchmarks and a stress test for the job list in jobs.c, built and
+ * run by "make bench-jobs".
+ *
+ * Each operation is timed on lists of 10, 1k, 100k and 1M jobs, with the
+ * jobs looked up in the order they were added (seq) or in a random order
+ * (rand), and reported as ns/op and allocs/op (malloc, calloc, realloc and
+ * strdup are counted through the linker's --wrap). An operation that runs
+ * past the time budget stops early, marked with *, and a list that cannot
+ * be filled within the budget is skipped, so the slow cases of the current
+ * data structure show up as numbers instead of hanging.
+ *
+ * The stress test runs random operations against both the job list and a
+ * simple array model of it and stops at the first difference.
+ *
+ * usage: bench_jobs [max_entries [budget_ms [stress_ops]]]
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./jobs.h"
+
+// fake PIDs, above PID_MAX_LIMIT (1 << 22) so none is real; never signalled
+#define PID_BASE ((1 << 22) + 1)
+#define MAX_OPS 100000     // timed operations per row, at most
+#define STRESS_MAX_JOBS 300
+
+/* allocation counting through -Wl,--wrap */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+
+static unsigned long long n_allocs = 0;
+
+void *__wrap_malloc(size_t size) {
+    n_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    n_allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    n_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str) {
+    n_allocs++;
+    return __real_strdup(str);
+}
+
+/* helpers */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, seeded the same every run so results can be compared */
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+/* returns a random number in [0, n) */
+static int random_below(int n) { return (int)(next_random() % (uint64_t)n); }
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void shuffle(int *keys, int n) {
+    for (int i = n - 1; i > 0; i--) {
+        int j = random_below(i + 1);
+        int swap = keys[i];
+        keys[i] = keys[j];
+        keys[j] = swap;
+    }
+}
+
+static pid_t pid_of(int jid) { return (pid_t)(PID_BASE + jid); }
+
+/* points stdout at /dev/null (quiet = 1) or back at the terminal (0) */
+static void quiet_stdout(int quiet) {
+    static int saved = -1;
+    fflush(stdout);
+    if (quiet) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        saved = dup(1);
+        dup2(null_fd, 1);
+        close(null_fd);
+    } else if (saved != -1) {
+        dup2(saved, 1);
+        close(saved);
+        saved = -1;
+    }
+}
+
+/* benchmarks */
+
+// one timed run of an operation
+struct timing {
+    uint64_t start_ns;
+    unsigned long long start_allocs;
+    uint64_t deadline_ns;
+    long ops;
+    int cut;  // 1 if the run hit the time budget
+};
+typedef struct timing timing_t;
+
+static uint64_t budget_ns;
+
+static void timing_start(timing_t *t) {
+    t->ops = 0;
+    t->cut = 0;
+    t->start_allocs = n_allocs;
+    t->start_ns = now_ns();
+    t->deadline_ns = t->start_ns + budget_ns;
+}
+
+/* counts one operation, returns 0 once the budget is used up (checked
+        every 64 operations to keep the clock out of the numbers) */
+static int timing_next(timing_t *t) {
+    t->ops++;
+    if ((t->ops & 63) == 0 && now_ns() > t->deadline_ns) {
+        t->cut = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static void timing_report(timing_t *t, const char *op, int entries,
+                          const char *pattern) {
+    uint64_t elapsed = now_ns() - t->start_ns;
+    unsigned long long allocs = n_allocs - t->start_allocs;
+    long ops = t->ops > 0 ? t->ops : 1;
+    printf("%-16s %8d  %-7s %8ld%s %12.1f %10.2f\n", op, entries, pattern,
+           t->ops, t->cut ? "*" : " ", (double)elapsed / (double)ops,
+           (double)allocs / (double)ops);
+    fflush(stdout);
+}
+
+/* removes jobs in the order they were added, which is always the head of
+        the list, so emptying it is cheap whatever the data structure */
+static void drain_list(job_list_t *job_list, int *keys, int n) {
+    for (int i = 0; i < n; i++) {
+        remove_job_jid(job_list, keys[i]);
+    }
+}
+
+/* runs every benchmark on a list of n jobs, added and looked up in order
+        (random = 0) or at random (random = 1) */
+static void bench_size(int n, int random) {
+    const char *pattern = random ? "rand" : "seq";
+    int *keys = (int *)malloc(sizeof(int) * (size_t)n);
+    int *lookups = (int *)malloc(sizeof(int) * (size_t)n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = i + 1;
+    }
+    if (random) {
+        shuffle(keys, n);
+    }
+    // lookups go in the order the jobs were added, or in a fresh order
+    memcpy(lookups, keys, sizeof(int) * (size_t)n);
+    if (random) {
+        shuffle(lookups, n);
+    }
+    int n_ops = n < MAX_OPS ? n : MAX_OPS;
+
+    job_list_t *job_list = init_job_list();
+    timing_t t;
+
+    timing_start(&t);
+    int added = 0;
+    while (added < n) {
+        add_job(job_list, keys[added], pid_of(keys[added]), RUNNING,
+                "/bin/sleep");
+        added++;
+        if (!timing_next(&t)) {
+            break;
+        }
+    }
+    timing_report(&t, "add_job", n, pattern);
+    if (added < n) {
+        printf("%-16s %8d  %-7s skipped, the list could not be filled "
+               "within the budget\n",
+               "(rest)", n, pattern);
+        drain_list(job_list, keys, added);
+        cleanup_job_list(job_list);
+        free(keys);
+        free(lookups);
+        return;
+    }
+
+    timing_start(&t);
+    for (int i = 0; i < n_ops; i++) {
+        if (get_job_jid(job_list, pid_of(lookups[i])) != lookups[i]) {
+            fprintf(stderr, "get_job_jid: wrong result\n");
+            exit(1);
+        }
+        if (!timing_next(&t)) {
+            break;
+        }
+    }
+    timing_report(&t, "get_job_jid", n, pattern);
+
+    timing_start(&t);
+    for (int i = 0; i < n_ops; i++) {
+        update_job_pid(job_list, pid_of(lookups[i]),
+                       (i & 1) ? RUNNING : STOPPED);
+        if (!timing_next(&t)) {
+            break;
+        }
+    }
+    timing_report(&t, "update_job_pid", n, pattern);
+
+    // whole cycles of the iterator, the pattern is the list's order
+    timing_start(&t);
+    while (get_next_pid(job_list) != -1) {
+    }
+    for (int i = 0; i < n_ops; i++) {
+        get_next_pid(job_list);
+        if (!timing_next(&t)) {
+            break;
+        }
+    }
+    timing_report(&t, "get_next_pid", n, pattern);
+
+    quiet_stdout(1);
+    timing_start(&t);
+    for (int i = 0; i < 16; i++) {
+        jobs(job_list);
+        if (!timing_next(&t) || now_ns() > t.deadline_ns) {
+            break;
+        }
+    }
+    quiet_stdout(0);
+    timing_report(&t, "jobs", n, pattern);
+
+    // removals shrink the list, so each takes a different part of it
+    int n_removes = n_ops / 2;
+    int removed_jid = 0;
+    timing_start(&t);
+    for (; removed_jid < n_removes; removed_jid++) {
+        remove_job_jid(job_list, lookups[removed_jid]);
+        if (!timing_next(&t)) {
+            removed_jid++;
+            break;
+        }
+    }
+    timing_report(&t, "remove_job_jid", n, pattern);
+
+    int removed_pid = removed_jid;
+    timing_start(&t);
+    for (; removed_pid < removed_jid + n_removes && removed_pid < n;
+         removed_pid++) {
+        remove_job_pid(job_list, pid_of(lookups[removed_pid]));
+        if (!timing_next(&t)) {
+            removed_pid++;
+            break;
+        }
+    }
+    timing_report(&t, "remove_job_pid", n, pattern);
+
+    // removing a job that is already gone is a no-op
+    drain_list(job_list, keys, n);
+    cleanup_job_list(job_list);
+    free(keys);
+    free(lookups);
+}
+
+/* stress test */
+
+// the model of one job, kept in an array in the order the jobs were added
+struct model_job {
+    int jid;
+    pid_t pid;
+    process_state_t state;
+    int timed_out;
+    char command[32];
+    char line[48];
+};
+typedef struct model_job model_job_t;
+
+static model_job_t model[STRESS_MAX_JOBS];
+static int model_len = 0;
+
+/* the first job with jid, or -1 */
+static int model_find_jid(int jid) {
+    for (int i = 0; i < model_len; i++) {
+        if (model[i].jid == jid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* the first job with pid that is not done, or -1 */
+static int model_find_pid(pid_t pid) {
+    for (int i = 0; i < model_len; i++) {
+        if (model[i].pid == pid && model[i].state != DONE) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void model_remove(int i) {
+    memmove(&model[i], &model[i + 1],
+            sizeof(model_job_t) * (size_t)(model_len - i - 1));
+    model_len--;
+}
+
+/* what jobs() should print for the model */
+static void model_jobs_text(char *out, size_t size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i < model_len && len < size; i++) {
+        model_job_t *job = &model[i];
+        const char *state = job->state == RUNNING ? "Running" : "Stopped";
+        if (job->state == DONE) {
+            state = "Done";
+        }
+        if (job->timed_out) {
+            state = "Timed out";
+        }
+        if (job->state == QUEUED) {
+            len += (size_t)snprintf(&out[len], size - len, "[%d] Queued %s\n",
+                                    job->jid, job->line);
+        } else {
+            len += (size_t)snprintf(&out[len], size - len,
+                                    "[%d] (%d) %s %s\n", job->jid, job->pid,
+                                    state, job->command);
+        }
+    }
+}
+
+/* captures what jobs() prints */
+static void list_jobs_text(job_list_t *job_list, char *out, size_t size) {
+    FILE *capture = tmpfile();
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(fileno(capture), 1);
+    jobs(job_list);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+
+    rewind(capture);
+    size_t len = fread(out, 1, size - 1, capture);
+    out[len] = '\0';
+    fclose(capture);
+}
+
+static void stress_fail(long op, const char *what, long got, long want) {
+    fprintf(stderr, "stress: operation %ld, %s returned %ld, expected %ld\n",
+            op, what, got, want);
+    exit(1);
+}
+
+#define CHECK(op, what, got, want)                      \
+    do {                                                \
+        long got_ = (long)(got);                        \
+        long want_ = (long)(want);                      \
+        if (got_ != want_) {                            \
+            stress_fail((op), (what), got_, want_);     \
+        }                                               \
+    } while (0)
+
+/* compares the whole list with the model */
+static void stress_compare(job_list_t *job_list, long op) {
+    int running = 0;
+    int first_queued = -1;
+    for (int i = 0; i < model_len; i++) {
+        running += model[i].state == RUNNING;
+        if (model[i].state == QUEUED && first_queued == -1) {
+            first_queued = model[i].jid;
+        }
+        CHECK(op, "get_job_pid", get_job_pid(job_list, model[i].jid),
+              model[i].pid);
+        CHECK(op, "get_job_state", get_job_state(job_list, model[i].jid),
+              model[i].state);
+    }
+    CHECK(op, "count_running_jobs", count_running_jobs(job_list), running);
+    CHECK(op, "next_queued_job", next_queued_job(job_list), first_queued);
+
+    // one whole cycle of the iterator, from wherever it was
+    while (get_next_pid(job_list) != -1) {
+    }
+    for (int i = 0; i < model_len; i++) {
+        CHECK(op, "get_next_pid", get_next_pid(job_list), model[i].pid);
+    }
+    CHECK(op, "get_next_pid", get_next_pid(job_list), -1);
+
+    static char got[STRESS_MAX_JOBS * 96];
+    static char want[STRESS_MAX_JOBS * 96];
+    list_jobs_text(job_list, got, sizeof(got));
+    model_jobs_text(want, sizeof(want));
+    if (strcmp(got, want) != 0) {
+        fprintf(stderr, "stress: operation %ld, jobs printed\n%s\nexpected\n%s",
+                op, got, want);
+        exit(1);
+    }
+}
+
+/* runs n_ops random operations on the job list and on the model */
+static void stress(long n_ops) {
+    job_list_t *job_list = init_job_list();
+    int next_jid = 1;
+    uint64_t start = now_ns();
+
+    for (long op = 0; op < n_ops; op++) {
+        // PIDs come from a small range so that they get reused
+        pid_t pid = (pid_t)(PID_BASE + random_below(STRESS_MAX_JOBS));
+        // JIDs that exist most of the time, and sometimes ones that do not
+        int jid = model_len > 0 && random_below(8) != 0
+                      ? model[random_below(model_len)].jid
+                      : random_below(next_jid + 2);
+        process_state_t state = (process_state_t)random_below(3);
+        int i;
+
+        switch (random_below(11)) {
+            case 0:
+            case 1:
+                if (model_len == STRESS_MAX_JOBS) {
+                    break;
+                }
+                i = model_len++;
+                model[i].jid = next_jid++;
+                model[i].pid = pid;
+                model[i].state = random_below(2) ? RUNNING : STOPPED;
+                model[i].timed_out = 0;
+                snprintf(model[i].command, sizeof(model[i].command),
+                         "/bin/cmd%d", model[i].jid);
+                CHECK(op, "add_job",
+                      add_job(job_list, model[i].jid, pid, model[i].state,
+                              model[i].command),
+                      0);
+                break;
+            case 2:
+                if (model_len == STRESS_MAX_JOBS) {
+                    break;
+                }
+                i = model_len++;
+                model[i].jid = next_jid++;
+                model[i].pid = 0;
+                model[i].state = QUEUED;
+                model[i].timed_out = 0;
+                snprintf(model[i].command, sizeof(model[i].command),
+                         "/bin/q%d", model[i].jid);
+                snprintf(model[i].line, sizeof(model[i].line), "/bin/q%d %d &",
+                         model[i].jid, model[i].jid);
+                CHECK(op, "queue_job",
+                      queue_job(job_list, model[i].jid, model[i].command,
+                                model[i].line),
+                      0);
+                break;
+            case 3:
+                i = model_find_jid(jid);
+                if (i != -1 && model[i].state != QUEUED) {
+                    i = -1;
+                }
+                if (i != -1) {
+                    model[i].state = RUNNING;
+                    model[i].pid = pid;
+                }
+                CHECK(op, "start_queued_job",
+                      start_queued_job(job_list, jid, pid), i != -1 ? 0 : -1);
+                break;
+            case 4:
+                i = model_find_jid(jid);
+                if (i != -1) {
+                    model_remove(i);
+                }
+                CHECK(op, "remove_job_jid", remove_job_jid(job_list, jid),
+                      i != -1 ? 0 : -1);
+                break;
+            case 5:
+                i = model_find_pid(pid);
+                if (i != -1) {
+                    model_remove(i);
+                }
+                CHECK(op, "remove_job_pid", remove_job_pid(job_list, pid),
+                      i != -1 ? 0 : -1);
+                break;
+            case 6:
+                i = model_find_pid(pid);
+                if (i != -1) {
+                    model[i].state = state;
+                }
+                CHECK(op, "update_job_pid",
+                      update_job_pid(job_list, pid, state), i != -1 ? 0 : -1);
+                break;
+            case 7:
+                i = model_find_jid(jid);
+                if (i != -1) {
+                    model[i].state = state;
+                }
+                CHECK(op, "update_job_jid",
+                      update_job_jid(job_list, jid, state), i != -1 ? 0 : -1);
+                break;
+            case 8:
+                i = model_find_pid(pid);
+                if (i != -1) {
+                    model[i].timed_out = 1;
+                }
+                CHECK(op, "set_job_timed_out", set_job_timed_out(job_list, pid),
+                      i != -1 ? 0 : -1);
+                break;
+            case 9:
+                i = model_find_pid(pid);
+                CHECK(op, "get_job_jid", get_job_jid(job_list, pid),
+                      i != -1 ? model[i].jid : -1);
+                break;
+            case 10:
+                // queueing is only done by queue_job
+                CHECK(op, "update_job_jid",
+                      update_job_jid(job_list, jid, QUEUED), -1);
+                break;
+        }
+
+        if (op % 500 == 0) {
+            stress_compare(job_list, op);
+        }
+    }
+    stress_compare(job_list, n_ops);
+
+    // empty the list without cleanup_job_list signalling the fake PIDs
+    while (model_len > 0) {
+        CHECK(n_ops, "remove_job_jid", remove_job_jid(job_list, model[0].jid),
+              0);
+        model_remove(0);
+    }
+    cleanup_job_list(job_list);
+    printf("stress: %ld random operations matched the model (%.1f s)\n",
+           n_ops, (double)(now_ns() - start) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    int max_entries = argc > 1 ? atoi(argv[1]) : 1000000;
+    long budget_ms = argc > 2 ? atol(argv[2]) : 5000;
+    long stress_ops = argc > 3 ? atol(argv[3]) : 200000;
+    budget_ns = (uint64_t)budget_ms * 1000000ULL;
+
+    static const int sizes[] = {10, 1000, 100000, 1000000};
+    printf("%-16s %8s  %-7s %9s %12s %10s\n", "op", "entries", "pattern",
+           "ops", "ns/op", "allocs/op");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        if (sizes[s] > max_entries) {
+            break;
+        }
+        bench_size(sizes[s], 0);
+        bench_size(sizes[s], 1);
+    }
+    printf("(* stopped at the %ld ms budget)\n\n", budget_ms);
+
+    stress(stress_ops);
+    return 0;
+}
@@ -0,0 +1,515 @@
+#include "./complete.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./vars.h"
+
+#define DIR_CACHE 64
+// less than DIR_CACHE, so reading PATH never evicts one of its own
+// directories while the completion still uses it
+#define MAX_PATH_DIRS 32
+
+// one entry of a directory
+struct entry {
+    const char *name;
+    unsigned char type;  // d_type, DT_UNKNOWN if the file system has none
+    signed char exec;    // 1 if executable, -1 until it has been checked
+};
+typedef struct entry entry_t;
+
+// a directory's entries, sorted by name
+struct dir_cache {
+    dev_t dev;  // 0 for an unused slot
+    ino_t ino;
+    struct timespec mtime;
+    int racy;  // 1 if it changed so recently that a change in the same
+               // clock tick could have been missed, then it is read again
+    int has_exec;  // 1 once exec is set for every entry
+    unsigned long last_used;
+    unsigned long pass;  // the completion that last looked at it
+    char *names;  // all the names, NUL separated
+    entry_t *entries;
+    int n;
+};
+typedef struct dir_cache dir_cache_t;
+
+// the matches of one source (builtins or a PATH directory) for a prefix
+struct range {
+    const entry_t *entries;
+    int pos;
+    int end;
+    const char *dir;  // the directory, NULL for builtins
+};
+typedef struct range range_t;
+
+static dir_cache_t dirs[DIR_CACHE];
+static unsigned long use_clock = 0;
+static unsigned long completion_pass = 0;
+
+static entry_t *builtins = NULL;
+static int n_builtins = 0;
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const entry_t *)a)->name, ((const entry_t *)b)->name);
+}
+
+/* sets the builtin names that are completed as commands, names ends with
+        NULL and must stay valid */
+void set_builtin_names(const char *const names[]) {
+    n_builtins = 0;
+    while (names[n_builtins] != NULL) {
+        n_builtins++;
+    }
+    free(builtins);
+    builtins = (entry_t *)malloc(sizeof(entry_t) * (size_t)(n_builtins + 1));
+    if (builtins == NULL) {
+        n_builtins = 0;
+        return;
+    }
+    for (int i = 0; i < n_builtins; i++) {
+        builtins[i].name = names[i];
+        builtins[i].type = DT_UNKNOWN;
+        builtins[i].exec = 1;
+    }
+    qsort(builtins, (size_t)n_builtins, sizeof(entry_t), compare_entries);
+}
+
+/* empties a cache slot */
+static void free_dir(dir_cache_t *dir) {
+    free(dir->names);
+    free(dir->entries);
+    memset(dir, 0, sizeof(dir_cache_t));
+}
+
+/* reads the directory open as fd into the slot, returns 0 on success,
+        -1 on failure */
+static int read_dir(dir_cache_t *dir, int fd, struct stat *st) {
+    DIR *stream = fdopendir(fd);
+    if (stream == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    // the names are gathered first and then sorted, entries hold offsets
+    // into names until it stops moving
+    size_t names_cap = 4096, names_len = 0;
+    int entries_cap = 256, n = 0;
+    char *names = (char *)malloc(names_cap);
+    entry_t *entries = (entry_t *)malloc(sizeof(entry_t) * (size_t)entries_cap);
+    struct dirent *ent;
+    while (names != NULL && entries != NULL &&
+           (ent = readdir(stream)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        size_t len = strlen(ent->d_name) + 1;
+        if (names_len + len > names_cap) {
+            while (names_len + len > names_cap) {
+                names_cap *= 2;
+            }
+            char *grown = (char *)realloc(names, names_cap);
+            if (grown == NULL) {
+                free(names);
+                names = NULL;
+                break;
+            }
+            names = grown;
+        }
+        if (n == entries_cap) {
+            entries_cap *= 2;
+            entry_t *grown = (entry_t *)realloc(
+                entries, sizeof(entry_t) * (size_t)entries_cap);
+            if (grown == NULL) {
+                free(entries);
+                entries = NULL;
+                break;
+            }
+            entries = grown;
+        }
+        memcpy(&names[names_len], ent->d_name, len);
+        entries[n].name = (const char *)names_len;
+        entries[n].type = ent->d_type;
+        entries[n].exec = -1;
+        names_len += len;
+        n++;
+    }
+    closedir(stream);
+    if (names == NULL || entries == NULL) {
+        free(names);
+        free(entries);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        entries[i].name = &names[(size_t)entries[i].name];
+    }
+    qsort(entries, (size_t)n, sizeof(entry_t), compare_entries);
+
+    // names that were there before keep whether they are executable, so
+    // only the new ones are checked
+    int has_exec = 1;
+    for (int i = 0, j = 0; i < n; i++) {
+        const entry_t *old = dir->entries;
+        while (j < dir->n && strcmp(old[j].name, entries[i].name) < 0) {
+            j++;
+        }
+        if (j < dir->n && strcmp(old[j].name, entries[i].name) == 0) {
+            entries[i].exec = old[j].exec;
+        }
+        if (entries[i].exec == -1) {
+            has_exec = 0;
+        }
+    }
+
+    free(dir->names);
+    free(dir->entries);
+    dir->dev = st->st_dev;
+    dir->ino = st->st_ino;
+    dir->mtime = st->st_mtim;
+    dir->names = names;
+    dir->entries = entries;
+    dir->n = n;
+    dir->has_exec = has_exec;
+
+    // file systems keep mtime in clock ticks, so a change made in the same
+    // tick as this read would leave it as it is
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    dir->racy = now.tv_sec - st->st_mtim.tv_sec < 2;
+    return 0;
+}
+
+/* works out which entries of dir (at path) that have not been checked yet
+        are executable files */
+static void check_exec(dir_cache_t *dir, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; i < dir->n; i++) {
+        entry_t *entry = &dir->entries[i];
+        if (entry->exec != -1) {
+            continue;
+        }
+        entry->exec = 0;
+        if (fd == -1 || entry->type == DT_DIR) {
+            continue;
+        }
+        if (entry->type != DT_REG) {
+            // a link or an unknown type may still be a directory
+            struct stat st;
+            if (fstatat(fd, entry->name, &st, 0) == -1 ||
+                !S_ISREG(st.st_mode)) {
+                continue;
+            }
+        }
+        entry->exec = faccessat(fd, entry->name, X_OK, AT_EACCESS) == 0;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    dir->has_exec = 1;
+}
+
+/*
+ * returns the cached entries of the directory path, read again if it has
+ * changed, with exec set if want_exec is 1. A directory is read at most once
+ * per completion, so entries taken from it earlier stay valid.
+ * returns NULL on failure
+ */
+static dir_cache_t *get_dir(const char *path, int want_exec) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    // the slot of this directory, or else the least recently used one
+    dir_cache_t *dir = NULL;
+    dir_cache_t *oldest = &dirs[0];
+    for (int i = 0; i < DIR_CACHE; i++) {
+        if (dirs[i].dev == st.st_dev && dirs[i].ino == st.st_ino &&
+            dirs[i].names != NULL) {
+            dir = &dirs[i];
+            break;
+        }
+        if (dirs[i].last_used < oldest->last_used) {
+            oldest = &dirs[i];
+        }
+    }
+
+    if (dir != NULL && (dir->pass == completion_pass ||
+                        (!dir->racy &&
+                         dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+                         dir->mtime.tv_nsec == st.st_mtim.tv_nsec))) {
+        close(fd);
+    } else {
+        if (dir == NULL) {
+            dir = oldest;
+            free_dir(dir);
+        }
+        if (read_dir(dir, fd, &st) == -1) {
+            free_dir(dir);
+            return NULL;
+        }
+    }
+
+    if (want_exec && !dir->has_exec) {
+        check_exec(dir, path);
+    }
+    dir->last_used = ++use_clock;
+    dir->pass = completion_pass;
+    return dir;
+}
+
+/* sets *pos and *end to the entries that start with the first len bytes
+        of prefix */
+static void find_prefix(const entry_t *entries, int n, const char *prefix,
+                        size_t len, int *pos, int *end) {
+    // the first entry not before prefix
+    int low = 0, high = n;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (strncmp(entries[mid].name, prefix, len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *pos = low;
+    // and the first one after the entries that start with it
+    high = n;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (strncmp(entries[mid].name, prefix, len) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *end = low;
+}
+
+/* returns the length of the common prefix of a and b */
+static size_t common_length(const char *a, const char *b) {
+    size_t len = 0;
+    while (a[len] != '\0' && a[len] == b[len]) {
+        len++;
+    }
+    return len;
+}
+
+/* adds name to the matches, keeping the common part of them all in
+        *common (first match) and *common_len */
+static void add_match(completion_t *completion, const char *name,
+                      const char **common, size_t *common_len) {
+    if (completion->n_matches == 0) {
+        *common = name;
+        *common_len = strlen(name);
+    } else {
+        size_t len = common_length(*common, name);
+        if (len < *common_len) {
+            *common_len = len;
+        }
+    }
+    if (completion->n_listed < COMPLETE_LIST) {
+        completion->list[completion->n_listed++] = name;
+    }
+    completion->n_matches++;
+}
+
+/* completes a command name from the builtins and the directories on PATH */
+static void complete_command(const char *word, size_t len,
+                             completion_t *completion) {
+    range_t ranges[MAX_PATH_DIRS + 1];
+    int n_ranges = 0;
+    if (n_builtins > 0) {
+        ranges[0].entries = builtins;
+        ranges[0].dir = NULL;
+        find_prefix(builtins, n_builtins, word, len, &ranges[0].pos,
+                    &ranges[0].end);
+        n_ranges++;
+    }
+
+    // the builtins take ranges[0], path_dirs only holds the directories
+    const char *path = get_var("PATH");
+    char dir_path[PATH_MAX];
+    static char path_dirs[MAX_PATH_DIRS][PATH_MAX];
+    int first_dir = n_ranges;
+    while (path != NULL && *path != '\0' &&
+           n_ranges - first_dir < MAX_PATH_DIRS) {
+        size_t dir_len = strcspn(path, ":");
+        if (dir_len > 0 && dir_len < PATH_MAX) {
+            memcpy(dir_path, path, dir_len);
+            dir_path[dir_len] = '\0';
+            dir_cache_t *dir = get_dir(dir_path, 1);
+            // a directory reached twice (e.g. /bin linked to /usr/bin)
+            // would only repeat the names it already gave
+            for (int i = 0; dir != NULL && i < n_ranges; i++) {
+                if (ranges[i].entries == dir->entries) {
+                    dir = NULL;
+                }
+            }
+            if (dir != NULL) {
+                range_t *range = &ranges[n_ranges];
+                range->entries = dir->entries;
+                find_prefix(dir->entries, dir->n, word, len, &range->pos,
+                            &range->end);
+                memcpy(path_dirs[n_ranges - first_dir], dir_path,
+                       dir_len + 1);
+                range->dir = path_dirs[n_ranges - first_dir];
+                n_ranges++;
+            }
+        }
+        path += dir_len;
+        if (*path == ':') {
+            path++;
+        }
+    }
+
+    // the ranges are sorted, so merging them visits each name once in
+    // order, and the source earliest on PATH provides it
+    const char *common = NULL;
+    size_t common_len = 0;
+    const char *found_dir = NULL;
+    while (1) {
+        int best = -1;
+        for (int i = 0; i < n_ranges; i++) {
+            range_t *range = &ranges[i];
+            while (range->pos < range->end &&
+                   range->entries[range->pos].exec == 0) {
+                range->pos++;
+            }
+            if (range->pos < range->end &&
+                (best == -1 || strcmp(range->entries[range->pos].name,
+                                      ranges[best].entries[ranges[best].pos]
+                                          .name) < 0)) {
+                best = i;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        const char *name = ranges[best].entries[ranges[best].pos].name;
+        if (completion->n_matches == 0) {
+            found_dir = ranges[best].dir;
+        }
+        add_match(completion, name, &common, &common_len);
+        // the same name further along PATH is hidden
+        for (int i = 0; i < n_ranges; i++) {
+            if (ranges[i].pos < ranges[i].end &&
+                strcmp(ranges[i].entries[ranges[i].pos].name, name) == 0) {
+                ranges[i].pos++;
+            }
+        }
+    }
+
+    if (completion->n_matches == 1) {
+        // the shell runs commands by their path
+        snprintf(completion->text, sizeof(completion->text), "%s%s%s ",
+                 found_dir != NULL ? found_dir : "",
+                 found_dir != NULL ? "/" : "", common);
+    } else if (completion->n_matches > 1) {
+        snprintf(completion->text, sizeof(completion->text), "%.*s",
+                 (int)common_len, common);
+    }
+}
+
+/* completes a path from the cached entries of its directory */
+static void complete_path(const char *word, size_t len, int command,
+                          completion_t *completion) {
+    // the directory part, up to the last /, stays as it is
+    size_t base = len;
+    while (base > 0 && word[base - 1] != '/') {
+        base--;
+    }
+    char dir_path[PATH_MAX];
+    if (base >= PATH_MAX) {
+        return;
+    }
+    if (base == 0) {
+        strcpy(dir_path, ".");
+    } else {
+        memcpy(dir_path, word, base);
+        dir_path[base] = '\0';
+    }
+    dir_cache_t *dir = get_dir(dir_path, command);
+    if (dir == NULL) {
+        return;
+    }
+
+    const char *prefix = &word[base];
+    size_t prefix_len = len - base;
+    int pos, end;
+    find_prefix(dir->entries, dir->n, prefix, prefix_len, &pos, &end);
+    const char *common = NULL;
+    size_t common_len = 0;
+    const entry_t *found = NULL;
+    for (; pos < end; pos++) {
+        const entry_t *entry = &dir->entries[pos];
+        // hidden names only when asked for, and only programs and the
+        // directories leading to them for a command
+        if ((entry->name[0] == '.' && prefix[0] != '.') ||
+            (command && entry->exec == 0 && entry->type != DT_DIR &&
+             entry->type != DT_LNK && entry->type != DT_UNKNOWN)) {
+            continue;
+        }
+        if (completion->n_matches == 0) {
+            found = entry;
+        }
+        add_match(completion, entry->name, &common, &common_len);
+    }
+
+    if (completion->n_matches == 1) {
+        int is_dir = found->type == DT_DIR;
+        if (found->type == DT_LNK || found->type == DT_UNKNOWN) {
+            char full[PATH_MAX];
+            struct stat st;
+            is_dir = snprintf(full, sizeof(full), "%s/%s", dir_path,
+                              found->name) < (int)sizeof(full) &&
+                     stat(full, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        snprintf(completion->text, sizeof(completion->text), "%.*s%s%s",
+                 (int)base, word, found->name, is_dir ? "/" : " ");
+    } else if (completion->n_matches > 1) {
+        snprintf(completion->text, sizeof(completion->text), "%.*s%.*s",
+                 (int)base, word, (int)common_len, common);
+    }
+}
+
+/*
+ * completes the first len bytes of word, as a command name if command is 1
+ * (a word with a / is always a path) and as a path otherwise. A single
+ * match is completed whole, followed by a space or, for a directory, a /.
+ * Otherwise text is extended as far as all matches agree.
+ * returns the number of matches
+ */
+int complete_word(const char *word, size_t len, int command,
+                  completion_t *completion) {
+    completion->n_matches = 0;
+    completion->n_listed = 0;
+    completion_pass++;
+    snprintf(completion->text, sizeof(completion->text), "%.*s", (int)len,
+             word);
+
+    if (command && memchr(word, '/', len) == NULL) {
+        complete_command(word, len, completion);
+    } else {
+        complete_path(word, len, command, completion);
+    }
+    return completion->n_matches;
+}
+
+/* reads the directories on PATH into the cache ahead of the first
+        completion */
+void prepare_completion(void) {
+    completion_t completion;
+    // a name no program has, so that nothing is collected
+    complete_word("\x01", 1, 1, &completion);
+}
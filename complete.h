@@ -0,0 +1,45 @@
+#ifndef COMPLETE_H_
+#define COMPLETE_H_
+
+#include <limits.h>
+#include <stddef.h>
+
+/*
+ * tab completion of command names and paths. Directories are read into a
+ * cache of sorted entries, one per directory, which is only read again
+ * when the directory's mtime changes, so a lookup is a stat and a binary
+ * search. Command names come from the directories on PATH, whose cached
+ * entries also record which ones are executable, and complete to the full
+ * path since the shell runs commands by path.
+ */
+
+// how many matches are kept for listing
+#define COMPLETE_LIST 100
+
+struct completion {
+    char text[PATH_MAX];  // what the word becomes
+    int n_matches;
+    int n_listed;  // matches in list, at most COMPLETE_LIST
+    const char *list[COMPLETE_LIST];  // names, valid until the next call
+};
+typedef struct completion completion_t;
+
+/* sets the builtin names that are completed as commands, names ends with
+        NULL and must stay valid */
+void set_builtin_names(const char *const names[]);
+
+/*
+ * completes the first len bytes of word, as a command name if command is 1
+ * (a word with a / is always a path) and as a path otherwise. A single
+ * match is completed whole, followed by a space or, for a directory, a /.
+ * Otherwise text is extended as far as all matches agree.
+ * returns the number of matches
+ */
+int complete_word(const char *word, size_t len, int command,
+                  completion_t *completion);
+
+/* reads the directories on PATH into the cache ahead of the first
+        completion */
+void prepare_completion(void);
+
+#endif  // COMPLETE_H_
@@ -0,0 +1,338 @@
+#include "./edit.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "./complete.h"
+
+// bytes read from the terminal but not used yet, e.g. the rest of a paste
+static char pending[4096];
+static size_t pending_len = 0;
+static size_t pending_pos = 0;
+static int prepared = 0;
+
+/* returns the next byte typed, -1 at the end of input or on failure */
+static int next_byte(void (*wait_input)(void)) {
+    if (pending_pos == pending_len) {
+        if (wait_input != NULL) {
+            wait_input();
+        }
+        ssize_t got;
+        do {
+            got = read(0, pending, sizeof(pending));
+        } while (got == -1 && errno == EINTR);
+        if (got <= 0) {
+            return -1;
+        }
+        pending_len = (size_t)got;
+        pending_pos = 0;
+    }
+    return (unsigned char)pending[pending_pos++];
+}
+
+/* returns 1 for the second and later bytes of a UTF-8 character */
+static int is_continuation(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+/* returns how many terminal columns the first len bytes of str take */
+static size_t columns(const char *str, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        n += !is_continuation(str[i]);
+    }
+    return n;
+}
+
+/* writes all of buffer to the terminal */
+static void put(const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t put = write(1, buffer, len);
+        if (put == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buffer += put;
+        len -= (size_t)put;
+    }
+}
+
+/* draws the prompt and the line again, with the cursor at cursor */
+static void redraw(const char *prompt, const char *line, size_t len,
+                   size_t cursor) {
+    // built in one buffer so the line is a single write and does not
+    // flicker
+    char out[8192];
+    size_t n = (size_t)snprintf(out, sizeof(out), "\r%s%.*s\033[K", prompt,
+                                (int)len, line);
+    size_t back = columns(&line[cursor], len - cursor);
+    if (back > 0 && n < sizeof(out)) {
+        n += (size_t)snprintf(&out[n], sizeof(out) - n, "\033[%zuD", back);
+    }
+    put(out, n < sizeof(out) ? n : sizeof(out) - 1);
+}
+
+/* returns 1 if a word starting at start is in the position of a command */
+static int command_position(const char *line, size_t start) {
+    static const char *keywords[] = {"if",   "then",  "else", "elif", "do",
+                                     "while", "until", "!"};
+    size_t end = start;
+    while (end > 0 && (line[end - 1] == ' ' || line[end - 1] == '\t')) {
+        end--;
+    }
+    if (end == 0 || strchr(";&|(", line[end - 1]) != NULL) {
+        return 1;
+    }
+    size_t word = end;
+    while (word > 0 && line[word - 1] != ' ' && line[word - 1] != '\t') {
+        word--;
+    }
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        if (strlen(keywords[i]) == end - word &&
+            strncmp(&line[word], keywords[i], end - word) == 0) {
+            return command_position(line, word);
+        }
+    }
+    return 0;
+}
+
+/* prints the matches in columns below the line */
+static void list_matches(completion_t *completion) {
+    struct winsize size;
+    int width = 80;
+    if (ioctl(1, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        width = size.ws_col;
+    }
+    int column = 0;
+    for (int i = 0; i < completion->n_listed; i++) {
+        int name_width = (int)strlen(completion->list[i]) + 2;
+        if (column > 0 && column + name_width > width) {
+            fputc('\n', stdout);
+            column = 0;
+        }
+        if (column == 0 && i == 0) {
+            fputc('\n', stdout);
+        }
+        fprintf(stdout, "%s  ", completion->list[i]);
+        column += name_width;
+    }
+    fputc('\n', stdout);
+    if (completion->n_matches > completion->n_listed) {
+        fprintf(stdout, "(%d more)\n",
+                completion->n_matches - completion->n_listed);
+    }
+    fflush(stdout);
+}
+
+/* completes the word before the cursor, or lists the matches below the
+        line if they do not share any more of it */
+static void complete_at(char line[], size_t size, size_t *len,
+                        size_t *cursor) {
+    size_t start = *cursor;
+    while (start > 0 && line[start - 1] != ' ' && line[start - 1] != '\t') {
+        start--;
+    }
+    static completion_t completion;
+    int n = complete_word(&line[start], *cursor - start,
+                          command_position(line, start), &completion);
+    if (n == 0) {
+        put("\a", 1);
+        return;
+    }
+
+    size_t new_len = strlen(completion.text);
+    size_t old_len = *cursor - start;
+    if (n > 1 && new_len == old_len) {
+        // nothing more is shared, so show the choices
+        list_matches(&completion);
+        return;
+    }
+    if (*len - old_len + new_len + 2 > size) {
+        put("\a", 1);
+        return;
+    }
+    memmove(&line[start + new_len], &line[*cursor], *len - *cursor);
+    memcpy(&line[start], completion.text, new_len);
+    *len = *len - old_len + new_len;
+    *cursor = start + new_len;
+}
+
+/*
+ * reads one line from the terminal on stdin, prompt is what has been
+ * printed before it and is printed again when the line is redrawn.
+ * wait_input, if not NULL, is called before each read and returns once
+ * stdin is readable.
+ * returns the length of the line (including its newline), 0 at the end of
+ * input, -1 on failure
+ */
+ssize_t edit_line(const char *prompt, char line[], size_t size,
+                  void (*wait_input)(void)) {
+    struct termios saved;
+    if (tcgetattr(0, &saved) == -1) {
+        return -1;
+    }
+    // keys arrive one at a time and are not echoed, ctrl-c is a key too
+    struct termios raw = saved;
+    raw.c_lflag &= (tcflag_t) ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(0, TCSADRAIN, &raw);
+    fflush(stdout);
+
+    if (!prepared) {
+        // the first tab should not have to read all of PATH
+        prepare_completion();
+        prepared = 1;
+    }
+
+    size_t len = 0;
+    size_t cursor = 0;
+    ssize_t result = -1;
+    while (result == -1) {
+        int c = next_byte(wait_input);
+        if (c == -1) {
+            // the end of input ends the line
+            line[len] = '\0';
+            result = (ssize_t)len;
+            break;
+        }
+
+        switch (c) {
+            case '\r':
+            case '\n':
+                line[len++] = '\n';
+                line[len] = '\0';
+                put("\n", 1);
+                result = (ssize_t)len;
+                continue;
+            case 3:  // ^C
+                put("^C\n", 3);
+                line[0] = '\n';
+                line[1] = '\0';
+                result = 1;
+                continue;
+            case 4:  // ^D
+                if (len == 0) {
+                    put("\n", 1);
+                    line[0] = '\0';
+                    result = 0;
+                    continue;
+                }
+                if (cursor < len) {
+                    size_t next = cursor + 1;
+                    while (next < len && is_continuation(line[next])) {
+                        next++;
+                    }
+                    memmove(&line[cursor], &line[next], len - next);
+                    len -= next - cursor;
+                }
+                break;
+            case 127:
+            case 8:  // backspace
+                if (cursor > 0) {
+                    size_t prev = cursor - 1;
+                    while (prev > 0 && is_continuation(line[prev])) {
+                        prev--;
+                    }
+                    memmove(&line[prev], &line[cursor], len - cursor);
+                    len -= cursor - prev;
+                    cursor = prev;
+                }
+                break;
+            case 1:  // ^A
+                cursor = 0;
+                break;
+            case 5:  // ^E
+                cursor = len;
+                break;
+            case 2:  // ^B
+                while (cursor > 0 && is_continuation(line[--cursor])) {
+                }
+                break;
+            case 6:  // ^F
+                if (cursor < len) {
+                    cursor++;
+                    while (cursor < len && is_continuation(line[cursor])) {
+                        cursor++;
+                    }
+                }
+                break;
+            case 11:  // ^K
+                len = cursor;
+                break;
+            case 21:  // ^U
+                memmove(line, &line[cursor], len - cursor);
+                len -= cursor;
+                cursor = 0;
+                break;
+            case 23: {  // ^W, the word before the cursor
+                size_t start = cursor;
+                while (start > 0 && line[start - 1] == ' ') {
+                    start--;
+                }
+                while (start > 0 && line[start - 1] != ' ') {
+                    start--;
+                }
+                memmove(&line[start], &line[cursor], len - cursor);
+                len -= cursor - start;
+                cursor = start;
+                break;
+            }
+            case 12:  // ^L
+                put("\033[H\033[2J", 7);
+                break;
+            case '\t':
+                complete_at(line, size, &len, &cursor);
+                break;
+            case 27: {  // escape sequences for the arrows, home, end, delete
+                int c2 = next_byte(wait_input);
+                if (c2 != '[' && c2 != 'O') {
+                    break;
+                }
+                int c3 = next_byte(wait_input);
+                int number = 0;
+                while (c3 >= '0' && c3 <= '9') {
+                    number = number * 10 + (c3 - '0');
+                    c3 = next_byte(wait_input);
+                }
+                if (c3 == 'D' && cursor > 0) {
+                    while (cursor > 0 && is_continuation(line[--cursor])) {
+                    }
+                } else if (c3 == 'C' && cursor < len) {
+                    cursor++;
+                    while (cursor < len && is_continuation(line[cursor])) {
+                        cursor++;
+                    }
+                } else if (c3 == 'H' || (c3 == '~' && number == 1)) {
+                    cursor = 0;
+                } else if (c3 == 'F' || (c3 == '~' && number == 4)) {
+                    cursor = len;
+                } else if (c3 == '~' && number == 3 && cursor < len) {
+                    size_t next = cursor + 1;
+                    while (next < len && is_continuation(line[next])) {
+                        next++;
+                    }
+                    memmove(&line[cursor], &line[next], len - next);
+                    len -= next - cursor;
+                }
+                break;
+            }
+            default:
+                // other control characters are ignored
+                if (c < 32 || len + 2 >= size) {
+                    break;
+                }
+                memmove(&line[cursor + 1], &line[cursor], len - cursor);
+                line[cursor++] = (char)c;
+                len++;
+                break;
+        }
+        redraw(prompt, line, len, cursor);
+    }
+
+    tcsetattr(0, TCSADRAIN, &saved);
+    return result;
+}
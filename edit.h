@@ -0,0 +1,26 @@
+#ifndef EDIT_H_
+#define EDIT_H_
+
+#include <sys/types.h>
+
+/*
+ * the line editor used when the shell reads from a terminal. The terminal
+ * is in raw mode only while a line is being edited, so jobs always get it
+ * back as it was. Keys: left/right (^B ^F), home/end (^A ^E), backspace,
+ * delete, ^K and ^U (delete to the end/start), ^W (delete a word), ^L
+ * (clear the screen), ^C (discard the line), ^D (end of input on an empty
+ * line) and tab, which completes command names and paths (see complete.h).
+ */
+
+/*
+ * reads one line from the terminal on stdin, prompt is what has been
+ * printed before it and is printed again when the line is redrawn.
+ * wait_input, if not NULL, is called before each read and returns once
+ * stdin is readable.
+ * returns the length of the line (including its newline), 0 at the end of
+ * input, -1 on failure
+ */
+ssize_t edit_line(const char *prompt, char line[], size_t size,
+                  void (*wait_input)(void));
+
+#endif  // EDIT_H_
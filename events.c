@@ -0,0 +1,182 @@
+#include "./events.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+
+struct event_source {
+    event_handler_t handler;
+    void *data;
+};
+typedef struct event_source event_source_t;
+
+// sources is indexed by file descriptor, descriptors are small and dense
+static event_source_t *sources = NULL;
+static int sources_len = 0;
+static int n_sources = 0;
+static int epoll_fd = -1;
+static int sigchld_fd = -1;
+static void (*child_handler)(void) = NULL;
+
+/* reads the pending SIGCHLD notifications, the reaping is done by waitpid */
+static void drain_sigchld(int fd, void *data) {
+    struct signalfd_siginfo info[8];
+    (void)data;
+    while (read(fd, info, sizeof(info)) > 0) {
+    }
+    if (child_handler != NULL) {
+        child_handler();
+    }
+}
+
+/* sets up the event loop, returns 0 on success, -1 on failure */
+int init_events(void) {
+    if (epoll_fd != -1) {
+        return 0;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    // children are reaped by waitpid, the signalfd only wakes the loop up
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    sigchld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd == -1) {
+        perror("signalfd");
+        return 0;
+    }
+    if (add_event(sigchld_fd, drain_sigchld, NULL) == 0) {
+        n_sources--;  // internal, not counted
+    }
+    return 0;
+}
+
+/*
+ * calls handler(fd, data) whenever fd is readable, setting up the loop if
+ * needed. returns 0 on success, -1 on failure
+ */
+int add_event(int fd, event_handler_t handler, void *data) {
+    if (fd < 0 || init_events() == -1) {
+        return -1;
+    }
+
+    if (fd >= sources_len) {
+        int new_len = sources_len ? sources_len : 64;
+        while (new_len <= fd) {
+            new_len *= 2;
+        }
+        event_source_t *grown = (event_source_t *)realloc(
+            sources, sizeof(event_source_t) * (size_t)new_len);
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        memset(&grown[sources_len], 0,
+               sizeof(event_source_t) * (size_t)(new_len - sources_len));
+        sources = grown;
+        sources_len = new_len;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return -1;
+    }
+
+    sources[fd].handler = handler;
+    sources[fd].data = data;
+    n_sources++;
+    return 0;
+}
+
+/* stops watching fd, returns 0 on success, -1 on failure */
+int remove_event(int fd) {
+    if (epoll_fd == -1 || fd < 0 || fd >= sources_len ||
+        sources[fd].handler == NULL) {
+        return -1;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    sources[fd].handler = NULL;
+    sources[fd].data = NULL;
+    n_sources--;
+    return 0;
+}
+
+/* calls handler from the event loop whenever a child has changed state,
+        NULL for none */
+void set_child_handler(void (*handler)(void)) { child_handler = handler; }
+
+/* returns the number of descriptors added with add_event */
+int event_count(void) { return n_sources; }
+
+/*
+ * waits up to timeout_ms milliseconds (-1 for no limit) for events and runs
+ * their handlers. A SIGCHLD also ends the wait.
+ * returns the number of events handled, -1 on failure
+ */
+int run_events(int timeout_ms) {
+    if (init_events() == -1) {
+        return -1;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (ready == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror("epoll_wait");
+        return -1;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        int fd = events[i].data.fd;
+        // a handler may have removed a later source in this batch
+        if (fd < sources_len && sources[fd].handler != NULL) {
+            sources[fd].handler(fd, sources[fd].data);
+        }
+    }
+    return ready;
+}
+
+/* marks the descriptor passed to wait_readable as ready */
+static void set_ready(int fd, void *data) {
+    (void)fd;
+    *(int *)data = 1;
+}
+
+/*
+ * blocks until fd is readable, running event handlers in the meantime
+ * returns 0 on success, -1 on failure
+ */
+int wait_readable(int fd) {
+    int ready = 0;
+    if (add_event(fd, set_ready, &ready) == -1) {
+        // regular files cannot be watched but are always readable
+        return errno == EPERM ? 0 : -1;
+    }
+
+    while (!ready) {
+        if (run_events(-1) == -1) {
+            break;
+        }
+    }
+
+    remove_event(fd);
+    return ready ? 0 : -1;
+}
@@ -0,0 +1,44 @@
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+/*
+ * the shell's event loop: an epoll set of descriptors, each with a handler
+ * that is called when the descriptor becomes readable. SIGCHLD is blocked
+ * and delivered through a signalfd in the same set once the loop is set up,
+ * so waiting for a child and servicing events is a single epoll_wait.
+ */
+
+typedef void (*event_handler_t)(int fd, void *data);
+
+/* sets up the event loop, returns 0 on success, -1 on failure */
+int init_events(void);
+
+/*
+ * calls handler(fd, data) whenever fd is readable, setting up the loop if
+ * needed. returns 0 on success, -1 on failure
+ */
+int add_event(int fd, event_handler_t handler, void *data);
+/* stops watching fd, returns 0 on success, -1 on failure */
+int remove_event(int fd);
+
+/* returns the number of descriptors added with add_event */
+int event_count(void);
+
+/* calls handler from the event loop whenever a child has changed state,
+        NULL for none */
+void set_child_handler(void (*handler)(void));
+
+/*
+ * waits up to timeout_ms milliseconds (-1 for no limit) for events and runs
+ * their handlers. A SIGCHLD also ends the wait.
+ * returns the number of events handled, -1 on failure
+ */
+int run_events(int timeout_ms);
+
+/*
+ * blocks until fd is readable, running event handlers in the meantime
+ * returns 0 on success, -1 on failure
+ */
+int wait_readable(int fd);
+
+#endif  // EVENTS_H_
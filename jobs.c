@@ -1,23 +1,35 @@
 #include "./jobs.h"
+#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "./procstat.h"
+
 struct job_element {
     int jid;
     pid_t pid;
     process_state_t state;
+    int timed_out;  // 1 once the job's time limit has expired
+    spool_t *spool;  // where the job's output goes, NULL if not spooled
     char *command;
+    char *line;  // the command line that starts a queued job, or NULL
     struct job_element *next;
+    struct job_element *next_queued;  // the queue, for QUEUED jobs
 };
 typedef struct job_element job_element_t;
 
 // head is the head of the list
 // current is the current element being iterated over
+// queue_head is the job that has been queued the longest, queue_tail the
+// newest
 struct job_list {
     job_element_t *head;
     job_element_t *current;
+    job_element_t *queue_head;
+    job_element_t *queue_tail;
+    int n_running;
     pid_t shell_pid;
 };
 
@@ -26,6 +38,9 @@ job_list_t *init_job_list() {
     job_list_t *job_list = (job_list_t *)malloc(sizeof(job_list_t));
     job_list->head = NULL;
     job_list->current = NULL;
+    job_list->queue_head = NULL;
+    job_list->queue_tail = NULL;
+    job_list->n_running = 0;
     job_list->shell_pid = getpid();
     return job_list;
 }
@@ -47,19 +62,27 @@ void cleanup_job_list(job_list_t *job_list) {
         // if we are cleaning up the shell's job list and not a child's
         if (getpid() == job_list->shell_pid) {
             /* kill process */
-            if (kill(-cur->pid, SIGKILL) < 0) {
+            // done and queued jobs have no process to kill
+            if (cur->state != DONE && cur->state != QUEUED &&
+                kill(-cur->pid, SIGKILL) < 0) {
                 perror("kill");
             }
+            // a forked child shares the shell's event loop, so only the
+            // shell stops draining the spools
+            spool_free(cur->spool);
         }
 
         if (cur->command != NULL) {
             free(cur->command);
             cur->command = NULL;
         }
+        free(cur->line);
 
         free(cur);
         cur = nextElement;
     }
+    // the descriptors jobs_usage keeps open
+    free_samples();
 
     job_list->head = NULL;
     job_list->current = NULL;
@@ -68,6 +91,44 @@ void cleanup_job_list(job_list_t *job_list) {
     free(job_list);
 }
 
+/* takes a queued job out of the queue */
+static void unqueue(job_list_t *job_list, job_element_t *job) {
+    job_element_t *prev = NULL;
+    job_element_t *cur = job_list->queue_head;
+    while (cur != NULL && cur != job) {
+        prev = cur;
+        cur = cur->next_queued;
+    }
+    if (cur == NULL) {
+        return;
+    }
+
+    if (prev != NULL) {
+        prev->next_queued = cur->next_queued;
+    } else {
+        job_list->queue_head = cur->next_queued;
+    }
+    if (job_list->queue_tail == cur) {
+        job_list->queue_tail = prev;
+    }
+    cur->next_queued = NULL;
+}
+
+/* changes a job's state, keeping the count of running jobs and the queue
+        up to date */
+static void set_state(job_list_t *job_list, job_element_t *job,
+                      process_state_t state) {
+    if (job->state == RUNNING) {
+        job_list->n_running--;
+    } else if (job->state == QUEUED) {
+        unqueue(job_list, job);
+    }
+    if (state == RUNNING) {
+        job_list->n_running++;
+    }
+    job->state = state;
+}
+
 /* adds new job to list, returns 0 on success, -1 on failure */
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
             char *command) {
@@ -82,6 +143,13 @@ int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
 
     // allocate new char*'s and copy buffers in to protect our code
     new->state = state;
+    if (state == RUNNING) {
+        job_list->n_running++;
+    }
+    new->timed_out = 0;
+    new->spool = NULL;
+    new->line = NULL;
+    new->next_queued = NULL;
 
     size_t cmdlen = strlen(command);
     new->command = (char *)malloc(sizeof(char) * (cmdlen + 1));
@@ -105,6 +173,107 @@ int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
     return 0;
 }
 
+/*
+ * adds a job that waits in the list's queue until it is started with
+ * start_queued_job, line is the command line that starts it.
+ * returns 0 on success, -1 on failure
+ */
+int queue_job(job_list_t *job_list, int jid, char *command, char *line) {
+    if (line == NULL || add_job(job_list, jid, 0, STOPPED, command) == -1) {
+        return -1;
+    }
+
+    // add_job put it at the tail
+    job_element_t *job = job_list->head;
+    while (job->next != NULL) {
+        job = job->next;
+    }
+    job->state = QUEUED;
+    job->line = strdup(line);
+
+    if (job_list->queue_tail != NULL) {
+        job_list->queue_tail->next_queued = job;
+    } else {
+        job_list->queue_head = job;
+    }
+    job_list->queue_tail = job;
+    return 0;
+}
+
+/* gets JID of the job that has been queued the longest,
+    returns -1 if no job is queued */
+int next_queued_job(job_list_t *job_list) {
+    if (job_list == NULL || job_list->queue_head == NULL) {
+        return -1;
+    }
+    return job_list->queue_head->jid;
+}
+
+/* gets the command line of a queued job, given job's JID,
+    returns NULL on failure */
+const char *get_queued_line(job_list_t *job_list, int jid) {
+    if (job_list == NULL) {
+        return NULL;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->jid == jid) {
+            return cur->state == QUEUED ? cur->line : NULL;
+        }
+
+        cur = cur->next;
+    }
+
+    return NULL;
+}
+
+/* records that a queued job was started as pid, given job's JID,
+    returns 0 on success, -1 on failure */
+int start_queued_job(job_list_t *job_list, int jid, pid_t pid) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->jid == jid && cur->state == QUEUED) {
+            set_state(job_list, cur, RUNNING);
+            cur->pid = pid;
+            free(cur->line);
+            cur->line = NULL;
+            return 0;
+        }
+
+        cur = cur->next;
+    }
+
+    return -1;
+}
+
+/* returns the number of RUNNING jobs */
+int count_running_jobs(job_list_t *job_list) {
+    return job_list == NULL ? 0 : job_list->n_running;
+}
+
+/* returns 1 if there is any job in the list, 0 otherwise */
+int has_jobs(job_list_t *job_list) {
+    return job_list != NULL && job_list->head != NULL;
+}
+
+/* frees a removed job */
+static void free_job(job_list_t *job_list, job_element_t *job) {
+    // leaving the list also leaves the running count and the queue
+    set_state(job_list, job, STOPPED);
+    if (job->command != NULL) {
+        free(job->command);
+        job->command = NULL;
+    }
+    free(job->line);
+    spool_free(job->spool);
+    free(job);
+}
+
 /* removes job from list, given job's JID,
     returns 0 on success, -1 on failure */
 int remove_job_jid(job_list_t *job_list, int jid) {
@@ -126,12 +295,7 @@ int remove_job_jid(job_list_t *job_list, int jid) {
                 job_list->current = cur->next;
             }
 
-            if (cur->command != NULL) {
-                free(cur->command);
-                cur->command = NULL;
-            }
-
-            free(cur);
+            free_job(job_list, cur);
             cur = NULL;
 
             return 0;
@@ -154,7 +318,7 @@ int remove_job_pid(job_list_t *job_list, pid_t pid) {
     job_element_t *prev = NULL;
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
-        if (cur->pid == pid) {
+        if (cur->pid == pid && cur->state != DONE) {
             if (prev != NULL) {
                 prev->next = cur->next;
             }
@@ -165,11 +329,7 @@ int remove_job_pid(job_list_t *job_list, pid_t pid) {
                 job_list->current = cur->next;
             }
 
-            if (cur->command != NULL) {
-                free(cur->command);
-                cur->command = NULL;
-            }
-            free(cur);
+            free_job(job_list, cur);
             cur = NULL;
 
             return 0;
@@ -184,14 +344,15 @@ int remove_job_pid(job_list_t *job_list, pid_t pid) {
 
 /* updates job's state, given job's JID, returns 0 on success, -1 on failure */
 int update_job_jid(job_list_t *job_list, int jid, process_state_t state) {
-    if (job_list == NULL) {
+    // only queue_job can queue a job
+    if (job_list == NULL || state == QUEUED) {
         return -1;
     }
 
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
         if (cur->jid == jid) {
-            cur->state = state;
+            set_state(job_list, cur, state);
             return 0;
         }
 
@@ -203,14 +364,132 @@ int update_job_jid(job_list_t *job_list, int jid, process_state_t state) {
 
 /* updates job's state, given job's PID, returns 0 on success, -1 on failure */
 int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state) {
+    if (job_list == NULL || state == QUEUED) {
+        return -1;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->pid == pid && cur->state != DONE) {
+            set_state(job_list, cur, state);
+            return 0;
+        }
+
+        cur = cur->next;
+    }
+
+    return -1;
+}
+
+/* returns 1 if sig does not end a process by default */
+static int keeps_running(int sig) {
+    return sig == 0 || sig == SIGCONT || sig == SIGSTOP || sig == SIGTSTP ||
+           sig == SIGTTIN || sig == SIGTTOU || sig == SIGCHLD ||
+           sig == SIGURG || sig == SIGWINCH;
+}
+
+/*
+ * sends sig to every job whose JID is in one of ranges[0] ... ranges[n - 1],
+ * in a single pass over the list and with one kill per process group.
+ * SIGCONT marks the jobs RUNNING and the stop signals mark them STOPPED,
+ * other states change when the jobs are reaped. Queued jobs have no process,
+ * a signal that would end one takes it out of the list instead.
+ * matched[i] is set to the number of jobs found in ranges[i].
+ * returns the number of jobs signalled or removed, -1 on failure
+ */
+int signal_jobs(job_list_t *job_list, const jid_range_t *ranges, int n,
+                int sig, int matched[]) {
+    if (job_list == NULL) {
+        return -1;
+    }
+    memset(matched, 0, sizeof(int) * (size_t)n);
+
+    int signalled = 0;
+    int dropped = 0;
+    for (job_element_t *cur = job_list->head; cur != NULL; cur = cur->next) {
+        int found = 0;
+        for (int i = 0; i < n; i++) {
+            if (cur->jid >= ranges[i].first && cur->jid <= ranges[i].last) {
+                matched[i]++;
+                found = 1;
+            }
+        }
+        if (!found || cur->state == DONE) {
+            continue;
+        }
+
+        if (cur->state == QUEUED) {
+            if (!keeps_running(sig)) {
+                // taken out of the queue and the list below, all at once
+                cur->state = DONE;
+                dropped++;
+                signalled++;
+            }
+            continue;
+        }
+        // the group cannot have been reused, its leader is the shell's
+        // child and is removed from the list as soon as it is reaped
+        if (kill(-cur->pid, sig) == -1) {
+            if (errno != ESRCH) {
+                fprintf(stderr, "kill: %%%d: %s \n", cur->jid,
+                        strerror(errno));
+            }
+            continue;
+        }
+        signalled++;
+        if (cur->state == STOPPED && !keeps_running(sig)) {
+            // a stopped process only acts on the signal once it runs
+            kill(-cur->pid, SIGCONT);
+        }
+        if (sig == SIGCONT) {
+            set_state(job_list, cur, RUNNING);
+        } else if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN ||
+                   sig == SIGTTOU) {
+            set_state(job_list, cur, STOPPED);
+        }
+    }
+    if (dropped == 0) {
+        return signalled;
+    }
+
+    // the dropped jobs are the ones left with PID 0 and no longer QUEUED
+    job_element_t **link = &job_list->queue_head;
+    job_list->queue_tail = NULL;
+    while (*link != NULL) {
+        if ((*link)->state != QUEUED) {
+            *link = (*link)->next_queued;
+        } else {
+            job_list->queue_tail = *link;
+            link = &(*link)->next_queued;
+        }
+    }
+    link = &job_list->head;
+    while (*link != NULL) {
+        job_element_t *cur = *link;
+        if (cur->pid == 0 && cur->state == DONE) {
+            *link = cur->next;
+            if (job_list->current == cur) {
+                job_list->current = cur->next;
+            }
+            free_job(job_list, cur);
+        } else {
+            link = &cur->next;
+        }
+    }
+    return signalled;
+}
+
+/* records that the job's time limit expired, given job's PID,
+    returns 0 on success, -1 on failure */
+int set_job_timed_out(job_list_t *job_list, pid_t pid) {
     if (job_list == NULL) {
         return -1;
     }
 
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
-        if (cur->pid == pid) {
-            cur->state = state;
+        if (cur->pid == pid && cur->state != DONE) {
+            cur->timed_out = 1;
             return 0;
         }
 
@@ -220,6 +499,63 @@ int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state) {
     return -1;
 }
 
+/* gives the job the spool its output goes to, given job's PID, the spool is
+    freed when the job is removed. returns 0 on success, -1 on failure */
+int set_job_spool(job_list_t *job_list, pid_t pid, spool_t *spool) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->pid == pid && cur->state != DONE) {
+            cur->spool = spool;
+            return 0;
+        }
+
+        cur = cur->next;
+    }
+
+    return -1;
+}
+
+/* gets the spool of a job, given job's JID, returns NULL if it has none */
+spool_t *get_job_spool(job_list_t *job_list, int jid) {
+    if (job_list == NULL) {
+        return NULL;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->jid == jid) {
+            return cur->spool;
+        }
+
+        cur = cur->next;
+    }
+
+    return NULL;
+}
+
+/* gets state of job, given job's JID, returns the state on success,
+    -1 on failure */
+int get_job_state(job_list_t *job_list, int jid) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->jid == jid) {
+            return (int)cur->state;
+        }
+
+        cur = cur->next;
+    }
+
+    return -1;
+}
+
 /* gets PID of job, given job's JID, returns PID on success, -1 on failure */
 pid_t get_job_pid(job_list_t *job_list, int jid) {
     if (job_list == NULL) {
@@ -246,7 +582,7 @@ int get_job_jid(job_list_t *job_list, pid_t pid) {
 
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
-        if (cur->pid == pid) {
+        if (cur->pid == pid && cur->state != DONE) {
             return cur->jid;
         }
 
@@ -286,8 +622,21 @@ void jobs(job_list_t *job_list) {
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
         char *state_string = cur->state == RUNNING ? "Running" : "Stopped";
-        if (printf("[%d] (%d) %s %s\n", cur->jid, cur->pid, state_string,
-                   cur->command) < 0) {
+        if (cur->state == DONE) {
+            state_string = "Done";
+        }
+        if (cur->timed_out) {
+            state_string = "Timed out";
+        }
+        int err;
+        if (cur->state == QUEUED) {
+            // no process yet, so no PID
+            err = printf("[%d] Queued %s\n", cur->jid, cur->line);
+        } else {
+            err = printf("[%d] (%d) %s %s\n", cur->jid, cur->pid,
+                         state_string, cur->command);
+        }
+        if (err < 0) {
             fprintf(stderr, "error printing jobs list\n");
             cleanup_job_list(job_list);
             exit(1);
@@ -295,3 +644,119 @@ void jobs(job_list_t *job_list) {
         cur = cur->next;
     }
 }
+
+// one line of jobs_usage
+struct usage_row {
+    job_element_t *job;
+    group_usage_t usage;
+};
+typedef struct usage_row usage_row_t;
+
+/* busiest first, then by JID */
+static int compare_cpu(const void *a, const void *b) {
+    const usage_row_t *x = (const usage_row_t *)a;
+    const usage_row_t *y = (const usage_row_t *)b;
+    if (x->usage.cpu_percent < y->usage.cpu_percent) {
+        return 1;
+    }
+    if (x->usage.cpu_percent > y->usage.cpu_percent) {
+        return -1;
+    }
+    return (x->job->jid > y->job->jid) - (x->job->jid < y->job->jid);
+}
+
+/* writes bytes as e.g. 512, 4.0K or 1.5G into out */
+static void format_size(char out[16], unsigned long long bytes) {
+    static const char units[] = "KMGTP";
+    if (bytes < 1024) {
+        snprintf(out, 16, "%llu", bytes);
+        return;
+    }
+    double value = (double)bytes / 1024;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(out, 16, "%.1f%c", value, units[unit]);
+}
+
+/*
+ * jobs -v and jobs --top, prints the jobs list with the processes, threads,
+ * CPU use, resident memory and bytes read and written of each job's process
+ * group. by_cpu sorts the list by CPU use, busiest first.
+ * returns the number of processes sampled, -1 on failure
+ */
+int jobs_usage(job_list_t *job_list, int by_cpu) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    int n = 0;
+    for (job_element_t *cur = job_list->head; cur != NULL; cur = cur->next) {
+        n++;
+    }
+    usage_row_t *rows =
+        (usage_row_t *)malloc(sizeof(usage_row_t) * (size_t)(n + 1));
+    group_usage_t *usage =
+        (group_usage_t *)malloc(sizeof(group_usage_t) * (size_t)(n + 1));
+    pid_t *pgids = (pid_t *)malloc(sizeof(pid_t) * (size_t)(n + 1));
+    if (rows == NULL || usage == NULL || pgids == NULL) {
+        perror("malloc");
+        free(rows);
+        free(usage);
+        free(pgids);
+        return -1;
+    }
+
+    // the PID of a done job may already be reused, and a queued job has
+    // no process yet
+    int i = 0;
+    for (job_element_t *cur = job_list->head; cur != NULL; cur = cur->next) {
+        rows[i].job = cur;
+        pgids[i] = cur->state == DONE || cur->state == QUEUED ? 0 : cur->pid;
+        i++;
+    }
+    int sampled = sample_groups(pgids, n, usage);
+    for (i = 0; i < n; i++) {
+        rows[i].usage = usage[i];
+    }
+    if (by_cpu) {
+        qsort(rows, (size_t)n, sizeof(usage_row_t), compare_cpu);
+    }
+
+    printf("%-6s %7s  %-9s %5s %7s %6s %7s %7s %7s  %s\n", "JOB", "PID",
+           "STATE", "PROCS", "THREADS", "CPU%", "RSS", "READ", "WRITTEN",
+           "COMMAND");
+    for (i = 0; i < n; i++) {
+        job_element_t *job = rows[i].job;
+        group_usage_t *u = &rows[i].usage;
+        char jid[16];
+        snprintf(jid, sizeof(jid), "[%d]", job->jid);
+        if (job->state == QUEUED) {
+            printf("%-6s %7s  %-9s %5s %7s %6s %7s %7s %7s  %s\n", jid, "-",
+                   "Queued", "-", "-", "-", "-", "-", "-", job->line);
+            continue;
+        }
+
+        char *state_string = job->state == RUNNING ? "Running" : "Stopped";
+        if (job->state == DONE) {
+            state_string = "Done";
+        }
+        if (job->timed_out) {
+            state_string = "Timed out";
+        }
+        char rss[16], read[16], written[16];
+        format_size(rss, u->rss_bytes);
+        format_size(read, u->read_bytes);
+        format_size(written, u->write_bytes);
+        printf("%-6s %7d  %-9s %5d %7d %6.1f %7s %7s %7s  %s\n", jid, job->pid,
+               state_string, u->n_procs, u->n_threads, u->cpu_percent, rss,
+               read, written, job->command);
+    }
+
+    free(rows);
+    free(usage);
+    free(pgids);
+    return sampled;
+}
@@ -4,7 +4,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-typedef enum { RUNNING, STOPPED } process_state_t;
+#include "./spool.h"
+
+// DONE is a spooled job that has finished but whose output has not been read
+// yet, lookups by PID skip it since its PID may already have been reused.
+// QUEUED is a background job waiting for the job limit (see sched.h), it has
+// no process yet and its PID is 0
+typedef enum { RUNNING, STOPPED, DONE, QUEUED } process_state_t;
 
 typedef struct job_list job_list_t;
 
@@ -21,6 +27,26 @@ void cleanup_job_list(job_list_t *job_list);
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
             char *command);
 
+/*
+ * adds a job that waits in the list's queue until it is started with
+ * start_queued_job, line is the command line that starts it.
+ * returns 0 on success, -1 on failure
+ */
+int queue_job(job_list_t *job_list, int jid, char *command, char *line);
+/* gets JID of the job that has been queued the longest,
+        returns -1 if no job is queued */
+int next_queued_job(job_list_t *job_list);
+/* gets the command line of a queued job, given job's JID,
+        returns NULL on failure */
+const char *get_queued_line(job_list_t *job_list, int jid);
+/* records that a queued job was started as pid, given job's JID,
+        returns 0 on success, -1 on failure */
+int start_queued_job(job_list_t *job_list, int jid, pid_t pid);
+/* returns the number of RUNNING jobs */
+int count_running_jobs(job_list_t *job_list);
+/* returns 1 if there is any job in the list, 0 otherwise */
+int has_jobs(job_list_t *job_list);
+
 /* removes job from list, given job's JID,
         returns 0 on success, -1 on failure */
 int remove_job_jid(job_list_t *job_list, int jid);
@@ -33,6 +59,38 @@ int update_job_jid(job_list_t *job_list, int jid, process_state_t state);
 /* updates job's state, given job's PID, returns 0 on success, -1 on failure */
 int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state);
 
+// an inclusive range of JIDs, e.g. %3-%7
+struct jid_range {
+    int first;
+    int last;
+};
+typedef struct jid_range jid_range_t;
+
+/*
+ * sends sig to every job whose JID is in one of ranges[0] ... ranges[n - 1],
+ * in a single pass over the list and with one kill per process group.
+ * SIGCONT marks the jobs RUNNING and the stop signals mark them STOPPED,
+ * other states change when the jobs are reaped. Queued jobs have no process,
+ * a signal that would end one takes it out of the list instead.
+ * matched[i] is set to the number of jobs found in ranges[i].
+ * returns the number of jobs signalled or removed, -1 on failure
+ */
+int signal_jobs(job_list_t *job_list, const jid_range_t *ranges, int n,
+                int sig, int matched[]);
+
+/* records that the job's time limit expired, given job's PID,
+        returns 0 on success, -1 on failure */
+int set_job_timed_out(job_list_t *job_list, pid_t pid);
+
+/* gives the job the spool its output goes to, given job's PID, the spool is
+        freed when the job is removed. returns 0 on success, -1 on failure */
+int set_job_spool(job_list_t *job_list, pid_t pid, spool_t *spool);
+/* gets the spool of a job, given job's JID, returns NULL if it has none */
+spool_t *get_job_spool(job_list_t *job_list, int jid);
+/* gets state of job, given job's JID, returns the state on success,
+        -1 on failure */
+int get_job_state(job_list_t *job_list, int jid);
+
 /* gets PID of job, given job's JID, returns PID on success, -1 on failure */
 pid_t get_job_pid(job_list_t *job_list, int jid);
 /* gets JID of job, given job's PID, returns JID on success, -1 on failure */
@@ -48,5 +106,12 @@ pid_t get_next_pid(job_list_t *job_list);
 
 /* jobs command, prints out the jobs list */
 void jobs(job_list_t *job_list);
+/*
+ * jobs -v and jobs --top, prints the jobs list with the processes, threads,
+ * CPU use, resident memory and bytes read and written of each job's process
+ * group. by_cpu sorts the list by CPU use, busiest first.
+ * returns the number of processes sampled, -1 on failure
+ */
+int jobs_usage(job_list_t *job_list, int by_cpu);
 
 #endif  // JOBS_H_
@@ -0,0 +1,336 @@
+#include "./procstat.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// a process seen in /proc
+struct proc {
+    pid_t pid;  // 0 for an empty slot
+    pid_t sid;  // its session, -1 until it has been read
+    ino_t ino;  // its /proc directory, which a reused PID gets anew
+    unsigned long long start;  // its start time, which tells reuses apart
+    unsigned generation;  // the last sample that saw it
+    int stat_fd;  // open while the process is in one of the groups, else -1
+    int io_fd;
+    unsigned long long ticks;  // utime + stime at the last sample
+    uint64_t sampled_ns;  // when that was, 0 if it has not been sampled
+};
+typedef struct proc proc_t;
+
+// a group being sampled, sorted by pgid to be found with bsearch
+struct group_index {
+    pid_t pgid;
+    int i;
+};
+typedef struct group_index group_index_t;
+
+// open addressing table keyed by PID, cap is a power of two and at most
+// half full
+static proc_t *procs = NULL;
+static size_t procs_cap = 0;
+static size_t procs_len = 0;
+static unsigned generation = 0;
+static size_t n_seen = 0;  // processes the current sample has seen
+static DIR *proc_dir = NULL;
+
+/* returns the slot for pid in table, either its entry or an empty one */
+static proc_t *find_slot(proc_t *table, size_t cap, pid_t pid) {
+    size_t i = ((size_t)pid * 2654435761U) & (cap - 1);
+    while (table[i].pid != 0 && table[i].pid != pid) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &table[i];
+}
+
+/* moves the processes into a table of new_cap slots, closing the ones the
+        current sample has not seen if drop_unseen is 1.
+        returns 0 on success, -1 on failure */
+static int rebuild(size_t new_cap, int drop_unseen) {
+    proc_t *table = (proc_t *)calloc(new_cap, sizeof(proc_t));
+    if (table == NULL) {
+        return -1;
+    }
+    procs_len = 0;
+    for (size_t i = 0; i < procs_cap; i++) {
+        proc_t *proc = &procs[i];
+        if (proc->pid == 0) {
+            continue;
+        }
+        if (drop_unseen && proc->generation != generation) {
+            // it has exited
+            if (proc->stat_fd != -1) {
+                close(proc->stat_fd);
+            }
+            if (proc->io_fd != -1) {
+                close(proc->io_fd);
+            }
+            continue;
+        }
+        *find_slot(table, new_cap, proc->pid) = *proc;
+        procs_len++;
+    }
+    free(procs);
+    procs = table;
+    procs_cap = new_cap;
+    return 0;
+}
+
+/* returns the entry for pid, adding it if needed, NULL on failure */
+static proc_t *get_proc(pid_t pid) {
+    if ((procs_len + 1) * 2 > procs_cap &&
+        rebuild(procs_cap ? procs_cap * 2 : 1024, 0) == -1) {
+        return NULL;
+    }
+    proc_t *proc = find_slot(procs, procs_cap, pid);
+    if (proc->pid == 0) {
+        proc->pid = pid;
+        proc->sid = -1;
+        proc->stat_fd = -1;
+        proc->io_fd = -1;
+        proc->sampled_ns = 0;
+        procs_len++;
+    }
+    return proc;
+}
+
+/* opens name ("stat" or "io") of pid, raising the descriptor limit to the
+        hard limit if needed. returns the descriptor, -1 on failure */
+static int open_proc_file(pid_t pid, const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "%d/%s", pid, name);
+    int fd = openat(dirfd(proc_dir), path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno == EMFILE) {
+        // two descriptors per process add up with many jobs
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+            limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            fd = openat(dirfd(proc_dir), path, O_RDONLY | O_CLOEXEC);
+        }
+    }
+    return fd;
+}
+
+/* reads all of fd from its start into buffer (NUL terminated),
+        returns the length, -1 on failure (e.g. the process exited) */
+static ssize_t read_file(int fd, char *buffer, size_t size) {
+    ssize_t got = pread(fd, buffer, size - 1, 0);
+    if (got >= 0) {
+        buffer[got] = '\0';
+    }
+    return got;
+}
+
+/* returns the value after "name: " in a /proc/<pid>/io file, 0 if missing */
+static unsigned long long io_field(const char *text, const char *name) {
+    const char *field = strstr(text, name);
+    return field != NULL ? strtoull(field + strlen(name), NULL, 10) : 0;
+}
+
+static int compare_groups(const void *a, const void *b) {
+    pid_t x = ((const group_index_t *)a)->pgid;
+    pid_t y = ((const group_index_t *)b)->pgid;
+    return (x > y) - (x < y);
+}
+
+/* forgets that proc was in a group and closes its descriptors */
+static void leave_groups(proc_t *proc) {
+    if (proc->stat_fd != -1) {
+        close(proc->stat_fd);
+        proc->stat_fd = -1;
+    }
+    if (proc->io_fd != -1) {
+        close(proc->io_fd);
+        proc->io_fd = -1;
+    }
+    proc->sampled_ns = 0;
+}
+
+/*
+ * samples every process in the process groups pgids[0] ... pgids[n - 1]
+ * (0 for no group) into usage[0] ... usage[n - 1].
+ * returns the number of processes sampled, -1 on failure
+ */
+int sample_groups(const pid_t *pgids, int n, group_usage_t *usage) {
+    memset(usage, 0, sizeof(group_usage_t) * (size_t)n);
+    if (proc_dir == NULL) {
+        proc_dir = opendir("/proc");
+        if (proc_dir == NULL) {
+            perror("/proc");
+            return -1;
+        }
+    } else {
+        rewinddir(proc_dir);
+    }
+
+    group_index_t *groups =
+        (group_index_t *)malloc(sizeof(group_index_t) * (size_t)(n + 1));
+    if (groups == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    int n_groups = 0;
+    for (int i = 0; i < n; i++) {
+        if (pgids[i] > 0) {
+            groups[n_groups].pgid = pgids[i];
+            groups[n_groups].i = i;
+            n_groups++;
+        }
+    }
+    qsort(groups, (size_t)n_groups, sizeof(group_index_t), compare_groups);
+
+    generation++;
+    n_seen = 0;
+    pid_t shell_sid = getsid(0);
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    // /proc start times count from boot, which CLOCK_BOOTTIME also does
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    int sampled = 0;
+    char buffer[1024];
+    struct dirent *entry;
+    while ((entry = readdir(proc_dir)) != NULL) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+            continue;
+        }
+        pid_t pid = (pid_t)atoi(entry->d_name);
+        proc_t *proc = get_proc(pid);
+        if (proc == NULL) {
+            break;
+        }
+        if (proc->generation != generation) {
+            proc->generation = generation;
+            n_seen++;
+        }
+        // other sessions are skipped without a read, as long as the PID
+        // still has the same /proc directory
+        if (proc->sid != -1 && proc->sid != shell_sid &&
+            proc->ino == entry->d_ino) {
+            continue;
+        }
+
+        // a kept descriptor stops working once its process exits, and the
+        // PID may already belong to a new process
+        if (proc->stat_fd != -1 &&
+            read_file(proc->stat_fd, buffer, sizeof(buffer)) <= 0) {
+            leave_groups(proc);
+        }
+        // processes outside the groups are read without keeping a
+        // descriptor, since there are usually far more of them
+        int fd = proc->stat_fd;
+        if (fd == -1) {
+            fd = open_proc_file(pid, "stat");
+            if (fd == -1 || read_file(fd, buffer, sizeof(buffer)) <= 0) {
+                if (fd != -1) {
+                    close(fd);
+                }
+                continue;
+            }
+        }
+
+        // the command name may contain spaces and parentheses, the fields
+        // start after the last )
+        char *fields = strrchr(buffer, ')');
+        int pgrp = 0, sid = 0;
+        unsigned long long utime = 0, stime = 0, start = 0;
+        long threads = 0, rss = 0;
+        if (fields == NULL ||
+            sscanf(fields + 2,
+                   "%*c %*d %d %d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d "
+                   "%*d %*d %*d %ld %*d %llu %*u %ld",
+                   &pgrp, &sid, &utime, &stime, &threads, &start,
+                   &rss) != 7) {
+            if (fd != proc->stat_fd) {
+                close(fd);
+            }
+            continue;
+        }
+        if (proc->sid != -1 && proc->start != start) {
+            // a new process with the PID, nothing sampled still applies
+            leave_groups(proc);
+        }
+        proc->sid = sid;
+        proc->ino = entry->d_ino;
+        proc->start = start;
+
+        group_index_t key;
+        key.pgid = pgrp;
+        group_index_t *group = (group_index_t *)bsearch(
+            &key, groups, (size_t)n_groups, sizeof(group_index_t),
+            compare_groups);
+        if (group == NULL) {
+            if (fd != proc->stat_fd) {
+                close(fd);
+            }
+            leave_groups(proc);
+            continue;
+        }
+        proc->stat_fd = fd;
+        if (proc->io_fd == -1) {
+            proc->io_fd = open_proc_file(pid, "io");
+        }
+
+        group_usage_t *total = &usage[group->i];
+        total->n_procs++;
+        total->n_threads += (int)threads;
+        total->rss_bytes +=
+            (unsigned long long)rss * (unsigned long long)page_size;
+        if (proc->io_fd != -1 &&
+            read_file(proc->io_fd, buffer, sizeof(buffer)) > 0) {
+            total->read_bytes += io_field(buffer, "rchar: ");
+            total->write_bytes += io_field(buffer, "wchar: ");
+        }
+
+        // CPU use since the last sample, or over the process's life
+        unsigned long long ticks = utime + stime;
+        unsigned long long busy_ticks = ticks;
+        uint64_t since =
+            (uint64_t)start * (1000000000ULL / (uint64_t)ticks_per_sec);
+        if (proc->sampled_ns != 0) {
+            busy_ticks = ticks - proc->ticks;
+            since = proc->sampled_ns;
+        }
+        if (now > since) {
+            total->cpu_percent += 100.0 * (double)busy_ticks /
+                                  (double)ticks_per_sec /
+                                  ((double)(now - since) / 1e9);
+        }
+        proc->ticks = ticks;
+        proc->sampled_ns = now;
+        sampled++;
+    }
+    free(groups);
+
+    // drop the processes that have exited
+    if (entry == NULL && n_seen < procs_len) {
+        rebuild(procs_cap, 1);
+    }
+    return sampled;
+}
+
+/* closes the descriptors kept between samples */
+void free_samples(void) {
+    generation++;  // nothing is current, so everything is closed
+    if (procs_cap > 0) {
+        rebuild(procs_cap, 1);
+    }
+    free(procs);
+    procs = NULL;
+    procs_cap = 0;
+    procs_len = 0;
+    if (proc_dir != NULL) {
+        closedir(proc_dir);
+        proc_dir = NULL;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef PROCSTAT_H_
+#define PROCSTAT_H_
+
+#include <sys/types.h>
+
+/*
+ * resource use of process groups, for jobs -v and jobs --top. One pass over
+ * /proc finds the processes of every group at once; a process in one of
+ * the groups keeps its /proc/<pid>/stat and io descriptors open, and they
+ * are read again with pread on the next sample instead of being reopened.
+ * Processes in other sessions are only read once, since they can never
+ * join one of the shell's jobs.
+ */
+
+// the totals over every process in one group
+struct group_usage {
+    int n_procs;
+    int n_threads;
+    double cpu_percent;  // since the last sample, or since the process
+                         // started for a process not sampled before
+    unsigned long long rss_bytes;
+    unsigned long long read_bytes;  // bytes read and written through
+    unsigned long long write_bytes;  // system calls, including pipes
+};
+typedef struct group_usage group_usage_t;
+
+/*
+ * samples every process in the process groups pgids[0] ... pgids[n - 1]
+ * (0 for no group) into usage[0] ... usage[n - 1].
+ * returns the number of processes sampled, -1 on failure
+ */
+int sample_groups(const pid_t *pgids, int n, group_usage_t *usage);
+
+/* closes the descriptors kept between samples */
+void free_samples(void);
+
+#endif  // PROCSTAT_H_
@@ -0,0 +1,85 @@
+#include "./sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef enum { LIMIT_OFF, LIMIT_COUNT, LIMIT_CORES, LIMIT_LOAD } limit_mode_t;
+
+static limit_mode_t limit_mode = LIMIT_OFF;
+static int limit_count = 0;
+
+/* returns the number of online CPUs, at least 1 */
+static int online_cores(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+/* returns the current limit while running jobs are running, 0 for none */
+static int current_limit(int running) {
+    switch (limit_mode) {
+        case LIMIT_OFF:
+            return 0;
+        case LIMIT_COUNT:
+            return limit_count;
+        case LIMIT_CORES:
+            return online_cores();
+        case LIMIT_LOAD: {
+            // one job per CPU, less the load our own running jobs do not
+            // explain; the load average lags, so it cannot bound a burst
+            double load;
+            int cores = online_cores();
+            if (getloadavg(&load, 1) != 1) {
+                return cores;
+            }
+            int other_load = (int)(load + 0.5) - running;
+            int limit = cores - (other_load > 0 ? other_load : 0);
+            return limit > 1 ? limit : 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * sets the limit from spec: a count, "cores", "load" or "off" (no limit),
+ * returns 0 on success, -1 if spec is not valid
+ */
+int set_job_limit(const char *spec) {
+    if (strcmp(spec, "off") == 0) {
+        limit_mode = LIMIT_OFF;
+    } else if (strcmp(spec, "cores") == 0) {
+        limit_mode = LIMIT_CORES;
+    } else if (strcmp(spec, "load") == 0) {
+        limit_mode = LIMIT_LOAD;
+    } else {
+        char *end;
+        long count = strtol(spec, &end, 10);
+        if (end == spec || *end != '\0' || count < 1 || count > 1000000) {
+            return -1;
+        }
+        limit_mode = LIMIT_COUNT;
+        limit_count = (int)count;
+    }
+    return 0;
+}
+
+/* prints the limit while running jobs are running, e.g. "cores (8)" */
+void print_job_limit(int running) {
+    static const char *names[] = {"off", "", "cores", "load"};
+    if (limit_mode == LIMIT_OFF) {
+        printf("off\n");
+    } else if (limit_mode == LIMIT_COUNT) {
+        printf("%d\n", limit_count);
+    } else {
+        printf("%s (%d)\n", names[limit_mode], current_limit(running));
+    }
+}
+
+/* returns 1 if there is a limit */
+int job_limit_active(void) { return limit_mode != LIMIT_OFF; }
+
+/* returns 1 if another job may start while running jobs are running */
+int can_start_job(int running) {
+    int limit = current_limit(running);
+    return limit == 0 || running < limit;
+}
@@ -0,0 +1,25 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+/*
+ * the limit on how many background jobs run at once. Jobs started with &
+ * beyond the limit wait in the job list's queue (QUEUED in jobs.h) and are
+ * started in the order they were queued as running jobs exit. The limit is
+ * a fixed count, the number of online CPUs, or the CPUs left over by the
+ * 1-minute load average, the last two are worked out again each time.
+ */
+
+/*
+ * sets the limit from spec: a count, "cores", "load" or "off" (no limit),
+ * returns 0 on success, -1 if spec is not valid
+ */
+int set_job_limit(const char *spec);
+/* prints the limit while running jobs are running, e.g. "cores (8)" */
+void print_job_limit(int running);
+
+/* returns 1 if there is a limit */
+int job_limit_active(void);
+/* returns 1 if another job may start while running jobs are running */
+int can_start_job(int running);
+
+#endif  // SCHED_H_
@@ -0,0 +1,699 @@
+#include "./script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./vars.h"
+
+#define MAX_WORDS 512
+
+typedef enum {
+    OP_RUN,            // run commands[arg]
+    OP_JUMP,           // continue at target
+    OP_JUMP_IF_FALSE,  // continue at target if the last status is not 0
+    OP_JUMP_IF_TRUE,   // continue at target if the last status is 0
+    OP_FOR_INIT,       // start a loop over the expanded words of commands[arg]
+    OP_FOR_NEXT,       // set the variable commands[arg] to the next word, or
+                       // leave the loop and continue at target
+    OP_FOR_POP,        // leave the innermost for loop (break)
+} opcode_t;
+
+struct op {
+    opcode_t code;
+    int arg;
+    int target;
+};
+typedef struct op op_t;
+
+struct command {
+    char **words;  // NULL-terminated, pointing into the script's text
+    int n_words;
+    int needs_expand;  // 1 if any word has a $
+};
+typedef struct command command_t;
+
+struct script {
+    char *text;  // copy of the source, cut into words by the lexer
+    op_t *code;
+    int n_code;
+    int code_cap;
+    command_t *commands;
+    int n_commands;
+    int commands_cap;
+};
+
+// the lexer turns every ; and newline into this token
+static char sep_token[] = ";";
+
+// the loop being compiled, for break and continue
+struct loop {
+    struct loop *outer;
+    int continue_target;
+    int *breaks;  // jumps to patch with the end of the loop
+    int n_breaks;
+    int breaks_cap;
+};
+typedef struct loop loop_t;
+
+struct parser {
+    script_t *script;
+    char **tokens;
+    int n_tokens;
+    int pos;
+    loop_t *loop;
+    int incomplete;  // 1 if the text ended in the middle of a construct
+};
+typedef struct parser parser_t;
+
+// a running for loop
+struct for_frame {
+    char **items;
+    int n_items;
+    int pos;
+    char **owned;  // expanded strings to free when the loop ends
+    int n_owned;
+};
+typedef struct for_frame for_frame_t;
+
+static int parse_list(parser_t *p, const char *terminators[]);
+
+/* returns 1 if line needs the script compiler (it has a ; or starts with a
+        keyword), 0 if it is a simple command */
+int is_script(const char *line) {
+    static const char *starters[] = {"for", "while", "until", "if"};
+
+    if (strchr(line, ';') != NULL) {
+        return 1;
+    }
+    line += strspn(line, " \t");
+    size_t len = strcspn(line, " \t\n");
+    for (size_t i = 0; i < sizeof(starters) / sizeof(starters[0]); i++) {
+        if (strlen(starters[i]) == len && strncmp(line, starters[i], len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * splits text in place into words and separators, # starts a comment
+ * returns the number of tokens, -1 on failure
+ */
+static int lex(char *text, char ***tokens_out) {
+    int cap = 64;
+    int n = 0;
+    char **tokens = (char **)malloc(sizeof(char *) * (size_t)cap);
+    if (tokens == NULL) {
+        return -1;
+    }
+
+    char *cur = text;
+    while (*cur) {
+        if (n + 2 >= cap) {
+            cap *= 2;
+            char **grown =
+                (char **)realloc(tokens, sizeof(char *) * (size_t)cap);
+            if (grown == NULL) {
+                free(tokens);
+                return -1;
+            }
+            tokens = grown;
+        }
+
+        if (*cur == ' ' || *cur == '\t') {
+            cur++;
+        } else if (*cur == '\n' || *cur == ';') {
+            tokens[n++] = sep_token;
+            cur++;
+        } else if (*cur == '#') {
+            cur += strcspn(cur, "\n");
+        } else {
+            char *word = cur;
+            tokens[n++] = word;
+            cur += strcspn(cur, " \t\n;");
+            char end = *cur;
+            if (end != '\0') {
+                *cur = '\0';
+                cur++;
+            }
+            // a & ends its command, which stays as the last word so the
+            // command still runs in the background
+            if (end == '\n' || end == ';' || strcmp(word, "&") == 0) {
+                tokens[n++] = sep_token;
+            }
+        }
+    }
+
+    *tokens_out = tokens;
+    return n;
+}
+
+/* appends an instruction, returns its index or -1 on failure */
+static int emit(parser_t *p, opcode_t code, int arg, int target) {
+    script_t *script = p->script;
+    if (script->n_code == script->code_cap) {
+        int cap = script->code_cap ? script->code_cap * 2 : 32;
+        op_t *grown =
+            (op_t *)realloc(script->code, sizeof(op_t) * (size_t)cap);
+        if (grown == NULL) {
+            perror("compile");
+            return -1;
+        }
+        script->code = grown;
+        script->code_cap = cap;
+    }
+
+    op_t *op = &script->code[script->n_code];
+    op->code = code;
+    op->arg = arg;
+    op->target = target;
+    return script->n_code++;
+}
+
+/* adds the tokens [start, end) as a command, returns its index or -1 */
+static int add_command(parser_t *p, int start, int end) {
+    script_t *script = p->script;
+    if (script->n_commands == script->commands_cap) {
+        int cap = script->commands_cap ? script->commands_cap * 2 : 16;
+        command_t *grown = (command_t *)realloc(
+            script->commands, sizeof(command_t) * (size_t)cap);
+        if (grown == NULL) {
+            perror("compile");
+            return -1;
+        }
+        script->commands = grown;
+        script->commands_cap = cap;
+    }
+
+    command_t *command = &script->commands[script->n_commands];
+    command->n_words = end - start;
+    command->needs_expand = 0;
+    command->words =
+        (char **)malloc(sizeof(char *) * (size_t)(command->n_words + 1));
+    if (command->words == NULL) {
+        perror("compile");
+        return -1;
+    }
+    for (int i = 0; i < command->n_words; i++) {
+        command->words[i] = p->tokens[start + i];
+        if (strchr(command->words[i], '$') != NULL) {
+            command->needs_expand = 1;
+        }
+    }
+    command->words[command->n_words] = NULL;
+    return script->n_commands++;
+}
+
+/* returns the current token, NULL at the end of the text */
+static char *peek(parser_t *p) {
+    return p->pos < p->n_tokens ? p->tokens[p->pos] : NULL;
+}
+
+/* returns 1 if tok is the keyword kw */
+static int is_keyword(const char *tok, const char *kw) {
+    return tok != NULL && tok != sep_token && strcmp(tok, kw) == 0;
+}
+
+static void skip_separators(parser_t *p) {
+    while (p->pos < p->n_tokens && p->tokens[p->pos] == sep_token) {
+        p->pos++;
+    }
+}
+
+/* prints a syntax error about the current token, returns -1 */
+static int syntax_error(parser_t *p) {
+    char *tok = peek(p);
+    if (tok == NULL) {
+        p->incomplete = 1;
+    } else {
+        fprintf(stderr, "syntax error near %s \n",
+                tok == sep_token ? "; or newline" : tok);
+    }
+    return -1;
+}
+
+/* consumes the keyword kw, skipping separators before it, returns 0 or -1 */
+static int expect(parser_t *p, const char *kw) {
+    skip_separators(p);
+    if (!is_keyword(peek(p), kw)) {
+        return syntax_error(p);
+    }
+    p->pos++;
+    return 0;
+}
+
+/* a compound command must be followed by a separator or the end */
+static int end_of_compound(parser_t *p) {
+    char *tok = peek(p);
+    if (tok != NULL && tok != sep_token) {
+        return syntax_error(p);
+    }
+    return 0;
+}
+
+/* records a jump that should go to the end of the current loop */
+static int add_break(parser_t *p, int jump) {
+    loop_t *loop = p->loop;
+    if (loop->n_breaks == loop->breaks_cap) {
+        int cap = loop->breaks_cap ? loop->breaks_cap * 2 : 4;
+        int *grown = (int *)realloc(loop->breaks, sizeof(int) * (size_t)cap);
+        if (grown == NULL) {
+            perror("compile");
+            return -1;
+        }
+        loop->breaks = grown;
+        loop->breaks_cap = cap;
+    }
+    loop->breaks[loop->n_breaks++] = jump;
+    return 0;
+}
+
+/* points the loop's breaks at target and leaves the loop */
+static void end_loop(parser_t *p, loop_t *loop, int target) {
+    for (int i = 0; i < loop->n_breaks; i++) {
+        p->script->code[loop->breaks[i]].target = target;
+    }
+    free(loop->breaks);
+    p->loop = loop->outer;
+}
+
+/*
+ * for NAME in WORDS; do LIST; done
+ *
+ *        FOR_INIT words
+ * next:  FOR_NEXT name, done
+ *        LIST
+ *        JUMP next
+ * break: FOR_POP
+ * done:
+ */
+static int parse_for(parser_t *p) {
+    p->pos++;
+    char *name = peek(p);
+    if (name == NULL || name == sep_token ||
+        !is_var_name(name, strlen(name))) {
+        return syntax_error(p);
+    }
+    p->pos++;
+    if (!is_keyword(peek(p), "in")) {
+        return syntax_error(p);
+    }
+    p->pos++;
+
+    int start = p->pos;
+    while (peek(p) != NULL && peek(p) != sep_token) {
+        p->pos++;
+    }
+    if (peek(p) == NULL) {
+        return syntax_error(p);
+    }
+    int list = add_command(p, start, p->pos);
+    int var = add_command(p, start - 2, start - 1);
+    if (list == -1 || var == -1 || expect(p, "do") == -1) {
+        return -1;
+    }
+
+    if (emit(p, OP_FOR_INIT, list, 0) == -1) {
+        return -1;
+    }
+    int next = emit(p, OP_FOR_NEXT, var, 0);
+    if (next == -1) {
+        return -1;
+    }
+
+    loop_t loop = {p->loop, next, NULL, 0, 0};
+    p->loop = &loop;
+    static const char *terminators[] = {"done", NULL};
+    if (parse_list(p, terminators) == -1 || expect(p, "done") == -1 ||
+        emit(p, OP_JUMP, 0, next) == -1) {
+        end_loop(p, &loop, 0);
+        return -1;
+    }
+    int pop = emit(p, OP_FOR_POP, 0, 0);
+    if (pop == -1) {
+        end_loop(p, &loop, 0);
+        return -1;
+    }
+    end_loop(p, &loop, pop);
+    p->script->code[next].target = p->script->n_code;
+    return end_of_compound(p);
+}
+
+/*
+ * while LIST; do LIST; done (until jumps on the opposite status)
+ *
+ * cond:  LIST
+ *        JUMP_IF_FALSE done
+ *        LIST
+ *        JUMP cond
+ * done:
+ */
+static int parse_while(parser_t *p) {
+    int until = is_keyword(peek(p), "until");
+    p->pos++;
+
+    int cond = p->script->n_code;
+    static const char *cond_terminators[] = {"do", NULL};
+    if (parse_list(p, cond_terminators) == -1 || expect(p, "do") == -1) {
+        return -1;
+    }
+    int exit_jump =
+        emit(p, until ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, 0, 0);
+    if (exit_jump == -1) {
+        return -1;
+    }
+
+    loop_t loop = {p->loop, cond, NULL, 0, 0};
+    p->loop = &loop;
+    static const char *terminators[] = {"done", NULL};
+    if (parse_list(p, terminators) == -1 || expect(p, "done") == -1 ||
+        emit(p, OP_JUMP, 0, cond) == -1) {
+        end_loop(p, &loop, 0);
+        return -1;
+    }
+    end_loop(p, &loop, p->script->n_code);
+    p->script->code[exit_jump].target = p->script->n_code;
+    return end_of_compound(p);
+}
+
+/*
+ * if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi
+ *
+ *        LIST
+ *        JUMP_IF_FALSE next
+ *        LIST
+ *        JUMP fi
+ * next:  (elif/else/fi)
+ */
+static int parse_if(parser_t *p) {
+    static const char *cond_terminators[] = {"then", NULL};
+    static const char *body_terminators[] = {"elif", "else", "fi", NULL};
+    static const char *else_terminators[] = {"fi", NULL};
+    int ends[64];
+    int n_ends = 0;
+
+    do {
+        p->pos++;  // if or elif
+        if (parse_list(p, cond_terminators) == -1 || expect(p, "then") == -1) {
+            return -1;
+        }
+        int next = emit(p, OP_JUMP_IF_FALSE, 0, 0);
+        if (next == -1 || parse_list(p, body_terminators) == -1) {
+            return -1;
+        }
+        if (n_ends == 64) {
+            fprintf(stderr, "syntax error: too many elif \n");
+            return -1;
+        }
+        ends[n_ends] = emit(p, OP_JUMP, 0, 0);
+        if (ends[n_ends++] == -1) {
+            return -1;
+        }
+        p->script->code[next].target = p->script->n_code;
+        skip_separators(p);
+    } while (is_keyword(peek(p), "elif"));
+
+    if (is_keyword(peek(p), "else")) {
+        p->pos++;
+        if (parse_list(p, else_terminators) == -1) {
+            return -1;
+        }
+    }
+    if (expect(p, "fi") == -1) {
+        return -1;
+    }
+    for (int i = 0; i < n_ends; i++) {
+        p->script->code[ends[i]].target = p->script->n_code;
+    }
+    return end_of_compound(p);
+}
+
+/* parses one command at the current token, returns 0 or -1 */
+static int parse_command(parser_t *p) {
+    static const char *reserved[] = {"do", "done", "then", "elif", "else",
+                                     "fi", "in"};
+    char *tok = peek(p);
+
+    if (is_keyword(tok, "for")) {
+        return parse_for(p);
+    } else if (is_keyword(tok, "while") || is_keyword(tok, "until")) {
+        return parse_while(p);
+    } else if (is_keyword(tok, "if")) {
+        return parse_if(p);
+    } else if (is_keyword(tok, "break") || is_keyword(tok, "continue")) {
+        if (p->loop == NULL) {
+            fprintf(stderr, "%s: only meaningful in a loop \n", tok);
+            return -1;
+        }
+        p->pos++;
+        if (tok[0] == 'c') {
+            return emit(p, OP_JUMP, 0, p->loop->continue_target) == -1 ? -1
+                                                                       : 0;
+        }
+        int jump = emit(p, OP_JUMP, 0, 0);
+        return jump == -1 ? -1 : add_break(p, jump);
+    }
+
+    for (size_t i = 0; i < sizeof(reserved) / sizeof(reserved[0]); i++) {
+        if (is_keyword(tok, reserved[i])) {
+            return syntax_error(p);
+        }
+    }
+
+    // a simple command runs up to the next separator
+    int start = p->pos;
+    while (peek(p) != NULL && peek(p) != sep_token) {
+        p->pos++;
+    }
+    if (p->pos - start >= MAX_WORDS) {
+        fprintf(stderr, "syntax error: too many words \n");
+        return -1;
+    }
+    int command = add_command(p, start, p->pos);
+    if (command == -1 || emit(p, OP_RUN, command, 0) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * parses commands until one of the terminators (a NULL-terminated list of
+ * keywords, not consumed) or, if terminators is NULL, the end of the text
+ * returns 0 or -1
+ */
+static int parse_list(parser_t *p, const char *terminators[]) {
+    while (1) {
+        skip_separators(p);
+        char *tok = peek(p);
+        if (tok == NULL) {
+            if (terminators != NULL) {
+                p->incomplete = 1;
+                return -1;
+            }
+            return 0;
+        }
+        for (int i = 0; terminators != NULL && terminators[i] != NULL; i++) {
+            if (is_keyword(tok, terminators[i])) {
+                return 0;
+            }
+        }
+        if (parse_command(p) == -1) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * compiles text into *script, the caller frees it with free_script.
+ * returns SCRIPT_OK, SCRIPT_INCOMPLETE, or SCRIPT_ERROR after printing a
+ * syntax error
+ */
+int compile_script(const char *text, script_t **script) {
+    script_t *new = (script_t *)calloc(1, sizeof(script_t));
+    if (new == NULL || (new->text = strdup(text)) == NULL) {
+        perror("compile");
+        free(new);
+        return SCRIPT_ERROR;
+    }
+
+    parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.script = new;
+    parser.n_tokens = lex(new->text, &parser.tokens);
+    if (parser.n_tokens == -1) {
+        perror("compile");
+        free_script(new);
+        return SCRIPT_ERROR;
+    }
+
+    int ret = parse_list(&parser, NULL);
+    free(parser.tokens);
+    if (ret == -1) {
+        free_script(new);
+        return parser.incomplete ? SCRIPT_INCOMPLETE : SCRIPT_ERROR;
+    }
+
+    *script = new;
+    return SCRIPT_OK;
+}
+
+/* frees a compiled script */
+void free_script(script_t *script) {
+    if (script == NULL) {
+        return;
+    }
+    for (int i = 0; i < script->n_commands; i++) {
+        free(script->commands[i].words);
+    }
+    free(script->commands);
+    free(script->code);
+    free(script->text);
+    free(script);
+}
+
+/* frees what a for loop allocated */
+static void free_frame(for_frame_t *frame) {
+    for (int i = 0; i < frame->n_owned; i++) {
+        free(frame->owned[i]);
+    }
+    free(frame->owned);
+    free(frame->items);
+}
+
+/*
+ * sets up a for loop over the words of command, expanding and splitting the
+ * ones with a $. returns 0 on success, 1 if an expansion failed (the loop
+ * then has no items), -1 on failure
+ */
+static int start_for(for_frame_t *frame, command_t *command) {
+    int cap = command->n_words > 0 ? command->n_words : 1;
+    memset(frame, 0, sizeof(*frame));
+    frame->items = (char **)malloc(sizeof(char *) * (size_t)cap);
+    frame->owned = (char **)malloc(sizeof(char *) * (size_t)cap);
+    if (frame->items == NULL || frame->owned == NULL) {
+        free_frame(frame);
+        return -1;
+    }
+
+    for (int i = 0; i < command->n_words; i++) {
+        char *word = command->words[i];
+        if (strchr(word, '$') == NULL) {
+            frame->items[frame->n_items++] = word;
+            continue;
+        }
+
+        char *expanded = expand_string(word);
+        if (expanded == NULL) {
+            frame->n_items = 0;
+            return 1;
+        }
+        frame->owned[frame->n_owned++] = expanded;
+        char *save;
+        for (char *field = strtok_r(expanded, " \t\n", &save); field != NULL;
+             field = strtok_r(NULL, " \t\n", &save)) {
+            if (frame->n_items == cap) {
+                cap *= 2;
+                char **grown = (char **)realloc(frame->items,
+                                                sizeof(char *) * (size_t)cap);
+                if (grown == NULL) {
+                    free_frame(frame);
+                    return -1;
+                }
+                frame->items = grown;
+            }
+            frame->items[frame->n_items++] = field;
+        }
+    }
+    return 0;
+}
+
+/* runs a compiled script, returns the exit status of its last command */
+int run_script(script_t *script, command_runner_t run) {
+    char *tokens[MAX_WORDS];
+    for_frame_t *frames = NULL;
+    int n_frames = 0;
+    int frames_cap = 0;
+    int pc = 0;
+
+    while (pc < script->n_code) {
+        op_t *op = &script->code[pc++];
+        switch (op->code) {
+            case OP_RUN: {
+                command_t *command = &script->commands[op->arg];
+                int n_tokens = command->n_words;
+                if (command->needs_expand) {
+                    reset_expansions();
+                    n_tokens = expand_words(command->words, tokens,
+                                            MAX_WORDS - 1);
+                } else {
+                    memcpy(tokens, command->words,
+                           sizeof(char *) * (size_t)(n_tokens + 1));
+                }
+                if (n_tokens < 0) {
+                    // the command is skipped, and fails
+                    last_status = n_tokens == -2 ? 2 : 1;
+                } else if (n_tokens > 0) {
+                    last_status = run(tokens);
+                }
+                break;
+            }
+            case OP_JUMP:
+                pc = op->target;
+                break;
+            case OP_JUMP_IF_FALSE:
+                if (last_status != 0) {
+                    pc = op->target;
+                }
+                break;
+            case OP_JUMP_IF_TRUE:
+                if (last_status == 0) {
+                    pc = op->target;
+                }
+                break;
+            case OP_FOR_INIT: {
+                if (n_frames == frames_cap) {
+                    frames_cap = frames_cap ? frames_cap * 2 : 4;
+                    for_frame_t *grown = (for_frame_t *)realloc(
+                        frames, sizeof(for_frame_t) * (size_t)frames_cap);
+                    if (grown == NULL) {
+                        perror("for");
+                        goto out;
+                    }
+                    frames = grown;
+                }
+                int started = start_for(&frames[n_frames],
+                                        &script->commands[op->arg]);
+                if (started == -1) {
+                    perror("for");
+                    goto out;
+                }
+                n_frames++;
+                last_status = started;
+                break;
+            }
+            case OP_FOR_NEXT: {
+                for_frame_t *frame = &frames[n_frames - 1];
+                if (frame->pos < frame->n_items) {
+                    set_var(script->commands[op->arg].words[0],
+                            frame->items[frame->pos++]);
+                } else {
+                    free_frame(frame);
+                    n_frames--;
+                    pc = op->target;
+                }
+                break;
+            }
+            case OP_FOR_POP:
+                free_frame(&frames[n_frames - 1]);
+                n_frames--;
+                break;
+        }
+    }
+
+out:
+    while (n_frames > 0) {
+        free_frame(&frames[--n_frames]);
+    }
+    free(frames);
+    return last_status;
+}
@@ -0,0 +1,39 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+/*
+ * control structures (for, while, until, if, break, continue and lists
+ * separated by ; or newlines). Text is compiled once into bytecode and the
+ * bytecode is run by a small interpreter, so loop bodies are never parsed
+ * again and builtins in them run without forking.
+ */
+
+#define SCRIPT_OK 0
+#define SCRIPT_INCOMPLETE 1  // more lines are needed, e.g. a missing done
+#define SCRIPT_ERROR -1
+
+typedef struct script script_t;
+
+/*
+ * runs one simple command, tokens is NULL-terminated and already expanded.
+ * returns the command's exit status
+ */
+typedef int (*command_runner_t)(char *tokens[]);
+
+/* returns 1 if line needs the script compiler (it has a ; or starts with a
+        keyword), 0 if it is a simple command */
+int is_script(const char *line);
+
+/*
+ * compiles text into *script, the caller frees it with free_script.
+ * returns SCRIPT_OK, SCRIPT_INCOMPLETE, or SCRIPT_ERROR after printing a
+ * syntax error
+ */
+int compile_script(const char *text, script_t **script);
+/* frees a compiled script */
+void free_script(script_t *script);
+
+/* runs a compiled script, returns the exit status of its last command */
+int run_script(script_t *script, command_runner_t run);
+
+#endif  // SCRIPT_H_
@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <spawn.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,12 +17,58 @@
 
 
 
+#include "complete.h"
+#include "edit.h"
+#include "events.h"
 #include "jobs.h"
+#include "sched.h"
+#include "script.h"
+#include "spool.h"
+#include "tee.h"
+#include "test.h"
+#include "timeout.h"
+#include "trace.h"
+#include "vars.h"
+#include "watch.h"
+
+#ifdef PROMPT
+#define PROMPT_TEXT "33sh> "
+#define MORE_PROMPT_TEXT "> "
+#else
+#define PROMPT_TEXT ""
+#define MORE_PROMPT_TEXT ""
+#endif
 
 job_list_t *job_list;
 char *fg_command[512];
 int job_number;
 pid_t parent_pgid;
+char *trace_file;
+volatile sig_atomic_t follow_interrupted;  // ctrl-c during joblog -f
+int starting_jid = -1;  // the queued job run_command is starting, or -1
+// extra processes of jobs (tee stages, process substitutions) that nothing
+// waits for, the reaper runs while there are any
+int stray_children = 0;
+// 0 when stdin is not a terminal, e.g. a script on a pipe, in which case
+// there is no terminal to hand over and commands are started with
+// posix_spawn
+int interactive = 1;
+
+// the builtins, completed as command names
+const char *const builtin_names[] = {
+    "cd",     "ln",       "rm",   "test",  "[",         "jobs",
+    "fg",     "bg",       "kill", "tee",   "echo",      "true",
+    "false",  ":",        "set",  "joblog", "joblimit", "wait",
+    "watch",  "tracedump", "exit", NULL};
+
+// queued jobs are started through run_command, and the builtins it runs
+// (fg, bg, wait, joblimit) start them
+void reaper();
+int run_command(char *tokens[], char *argv[]);
+void start_queued_jobs();
+int start_queued_job_now(int jid, int foreground);
+// the kill builtin takes signals the way timeout does
+int parse_signal(const char *str);
 
 /*
  * Removes whitespace from buffer and creates an array with each input on the
@@ -71,12 +121,16 @@ stored in this array
 file is stored in this array
 *  - is_append: an int that is 0 if the redirect symbol indicates appending
 (>>) and 1 if not
+*  - is_background: set to 1 if the line ends with &
+*  - stage_argv: if the line contains a |, the words of the stage after it
+(e.g. tee and its files) are stored in this array
 *
 * Returns:
 *  - 1 if argv was empty (no input) and 0 if not
 */
 int parse_redirects(char *argv[], char *no_redirect[], char *input_file[],
-                    char *output_file[], int *is_append, int *is_background) {
+                    char *output_file[], int *is_append, int *is_background,
+                    char *stage_argv[]) {
     int no_redirects_counter = 0;
     int amt_input_redirects = 0;
     int amt_output_redirects = 0;
@@ -103,6 +157,7 @@ int parse_redirects(char *argv[], char *no_redirect[], char *input_file[],
                 /* if argv is empty*/
                 return 1;
             }
+            break;  // nothing follows the end of the command
 
         } else if (strcmp(argv[i], "<") == 0 && !argv[i + 1]) {
             /* no input file specified */
@@ -168,6 +223,24 @@ int parse_redirects(char *argv[], char *no_redirect[], char *input_file[],
             // if argv[i] is & and is the last character, should be a background
             // job
             *is_background = 1;
+        } else if (strcmp(argv[i], "|") == 0) {
+            if (!argv[i + 1] || strcmp(argv[i + 1], "&") == 0) {
+                /* nothing after the | */
+                fprintf(stderr, "must specify command after | \n");
+                break;
+            }
+            // everything after the | belongs to the second stage, except a
+            // trailing & which still applies to the whole job
+            int stage_counter = 0;
+            for (i++; argv[i]; i++) {
+                if (strcmp(argv[i], "&") == 0 && !argv[i + 1]) {
+                    *is_background = 1;
+                } else {
+                    stage_argv[stage_counter] = argv[i];
+                    stage_counter++;
+                }
+            }
+            break;
         } else {
             no_redirect[no_redirects_counter] = argv[i];
             no_redirects_counter++;
@@ -177,27 +250,329 @@ int parse_redirects(char *argv[], char *no_redirect[], char *input_file[],
 }
 
 /*
-* Checks if cd, rm, ln, exit, fg, and bg was called and executes appropriately.
-*
-* Parameters:
-*  - no_redirect: an array containing all the elements of argv except the
-redirect symbols and their accompanying files
-*  - tokens: an array containing the parsed inputs, including the filepath
-*  - is_background: a pointer to an int that tells if it is a background process or not
-*
-* Returns:
-*  - 1 if cd, rm, ln, fg, and bg was called and 0 otherwise
-*/
-int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
+ * Marks a job whose time limit expired, called from the event loop
+ *
+ * Parameters:
+ *  - pgid: the process group (and PID) of the job
+ *
+ * Returns:
+ *  - nothing
+ */
+void job_timed_out(pid_t pgid) { set_job_timed_out(job_list, pgid); }
+
+/*
+ * Gives the prefix for a job's exit message that says whether it was ended
+ * by its time limit
+ *
+ * Parameters:
+ *  - pid: the PID of the job
+ *
+ * Returns:
+ *  - "timed out, " if the job's time limit expired and "" otherwise
+ */
+const char *timeout_note(pid_t pid) {
+    return timeout_expired(pid) ? "timed out, " : "";
+}
+
+/*
+ * Waits for a foreground job to exit or stop, like waitpid with WUNTRACED,
+ * but keeps running the shell's event loop (e.g. time limits) meanwhile
+ *
+ * Parameters:
+ *  - pid: the PID of the job
+ *  - status: where the wait status is stored
+ *
+ * Returns:
+ *  - the PID on success, -1 on failure
+ */
+pid_t wait_job(pid_t pid, int *status) {
+    if (event_count() == 0) {
+        return waitpid(pid, status, WUNTRACED);
+    }
+
+    while (1) {
+        // SIGCHLD wakes run_events up, so the child cannot be missed
+        pid_t wait_err = waitpid(pid, status, WUNTRACED | WNOHANG);
+        if (wait_err != 0) {
+            return wait_err;
+        }
+        if (run_events(-1) == -1) {
+            return waitpid(pid, status, WUNTRACED);
+        }
+    }
+}
+
+/*
+ * Gives the terminal to a process group, nothing is done when the shell is
+ * not interactive since stdin is then not a terminal
+ *
+ * Parameters:
+ *  - pgid: the process group that gets the terminal
+ *
+ * Returns:
+ *  - nothing
+ */
+void give_terminal(pid_t pgid) {
+    if (interactive) {
+        tcsetpgrp(0, pgid);
+    }
+}
+
+/*
+ * Turns one of the shell's options (set -o name / set +o name) on or off
+ *
+ * Parameters:
+ *  - name: the name of the option
+ *  - on: 1 to turn the option on, 0 to turn it off
+ *
+ * Returns:
+ *  - 0 on success, -1 if the option is unknown or could not be changed
+ */
+int set_option(const char *name, int on) {
+    if (strcmp(name, "trace") == 0) {
+        if (on) {
+            return trace_start();
+        }
+        trace_stop();
+        return 0;
+    } else if (strcmp(name, "spool") == 0) {
+        // only jobs started from now on are affected
+        spool_enabled = on;
+        return 0;
+    }
+
+    fprintf(stderr, "set: unknown option %s \n", name);
+    return -1;
+}
+
+/*
+ * Writes the trace to the file named by SH33_TRACE when the shell exits
+ *
+ * Returns:
+ *  - nothing
+ */
+void dump_trace_at_exit(void) {
+    // forked children exit through here as well
+    if (getpid() == parent_pgid) {
+        trace_dump(trace_file);
+    }
+}
+
+/*
+ * Installs the signal handler so that we can handle the signals
+ *
+ * Parameters:
+ *  - sig: an int representing the signal
+ * - handler: the handler we want to install
+ *
+ * Returns:
+ *  - int
+ */
+int install_handler(int sig, void (*handler)(int)) {
+    if (signal(sig, handler) != SIG_ERR) {
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Stops joblog -f when ctrl-c is pressed, the shell otherwise ignores SIGINT
+ *
+ * Parameters:
+ *  - sig: the signal number (SIGINT)
+ *
+ * Returns:
+ *  - nothing
+ */
+void stop_following(int sig) {
+    (void)sig;
+    follow_interrupted = 1;
+}
+
+/*
+ * Opens the output redirect of a builtin, which runs inside the shell and so
+ * writes to its own descriptor instead of replacing the shell's stdout
+ *
+ * Parameters:
+ *  - output_file: the output redirect, or "stdout" if there is none
+ *  - is_append: 1 if the output redirect is an append (>>)
+ *
+ * Returns:
+ *  - the descriptor to write to (1 without a redirect), -1 on failure
+ */
+int builtin_output(char *output_file[], int is_append) {
+    if (strcmp(output_file[0], "stdout") == 0) {
+        return 1;
+    }
+    int flags = O_CREAT | O_WRONLY | (is_append ? O_APPEND : O_TRUNC);
+    int out_fd = open(output_file[0], flags, S_IRWXU);
+    if (out_fd == -1) {
+        perror("output error");
+    }
+    return out_fd;
+}
+
+/*
+ * Reads the monotonic clock, for waits that keep the event loop running
+ *
+ * Returns:
+ *  - the time in milliseconds
+ */
+long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// the words of a watched command, leaving room in a 512-token line for its
+// redirects, the & and the NULL
+#define WATCH_MAX_WORDS 506
+
+/*
+ * Starts one run of the command of the watch builtin as a background job,
+ * with the redirects that were typed with watch
+ *
+ * Parameters:
+ *  - command: the command's words, starting with its path
+ *  - input_file: the input redirect, or "stdin" if there is none
+ *  - output_file: the output redirect, or "stdout" if there is none
+ *  - is_append: 1 if the output redirect is an append (>>)
+ *
+ * Returns:
+ *  - the job ID of the run, -1 if no job was started
+ */
+int start_watched_run(char *command[], char *input_file[],
+                      char *output_file[], int is_append) {
+    char *tokens[512];
+    char *argv[512];
+    int n = 0;
+    for (; command[n] != NULL && n < WATCH_MAX_WORDS; n++) {
+        tokens[n] = command[n];
+    }
+    if (strcmp(input_file[0], "stdin") != 0) {
+        tokens[n++] = "<";
+        tokens[n++] = input_file[0];
+    }
+    if (strcmp(output_file[0], "stdout") != 0) {
+        tokens[n++] = is_append ? ">>" : ">";
+        tokens[n++] = output_file[0];
+    }
+    tokens[n++] = "&";
+    tokens[n] = NULL;
+    memcpy(argv, tokens, sizeof(char *) * (size_t)(n + 1));
+    char *occurrence = strrchr(tokens[0], '/');
+    argv[0] = occurrence != NULL ? occurrence + 1 : tokens[0];
+
+    int jid = job_number;
+    run_command(tokens, argv);
+    return job_number > jid ? jid : -1;
+}
+
+/*
+ * Ends a run started by start_watched_run: a run that is still going has
+ * its process group sent SIGTERM (SIGKILL if it has not exited after
+ * WATCH_GRACE_MS) and is waited for, and the job leaves the job list
+ *
+ * Parameters:
+ *  - jid: the job ID of the run, or -1
+ *
+ * Returns:
+ *  - nothing
+ */
+void end_watched_run(int jid) {
+    int state = get_job_state(job_list, jid);
+    if (state == QUEUED || state == DONE) {
+        remove_job_jid(job_list, jid);
+        return;
+    }
+    if (state == -1) {
+        return;
+    }
+
+    pid_t pid = get_job_pid(job_list, jid);
+    kill(-pid, SIGTERM);
+    kill(-pid, SIGCONT);
+    long long deadline_ms = monotonic_ms() + WATCH_GRACE_MS;
+    int killed = 0;
+    while (!follow_interrupted) {
+        reaper();
+        state = get_job_state(job_list, jid);
+        if (state == -1 || state == DONE) {
+            break;
+        }
+        long long left_ms = deadline_ms - monotonic_ms();
+        if (left_ms <= 0 && !killed) {
+            kill(-pid, SIGKILL);
+            killed = 1;
+        }
+        if (run_events(killed ? -1 : (int)left_ms) == -1) {
+            break;
+        }
+    }
+    if (get_job_state(job_list, jid) == DONE) {
+        // a spooled run's output is replaced by the next run's
+        remove_job_jid(job_list, jid);
+    }
+}
+
+/*
+ * Tells whether a command is the test or [ builtin: the bare word, or the
+ * usual /bin and /usr/bin programs, so scripts written for them no longer
+ * fork. Any other program that happens to be called test is run.
+ *
+ * Parameters:
+ *  - command: the first token of the command, as typed
+ *
+ * Returns:
+ *  - 1 if it is test or [, 0 otherwise
+ */
+int is_test_command(const char *command) {
+    static const char *const names[] = {"test",          "[",
+                                        "/bin/test",     "/bin/[",
+                                        "/usr/bin/test", "/usr/bin/["};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(command, names[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Checks if one of the builtins cd, ln, rm, test, [, jobs, fg, bg, kill,
+ * set, joblog, joblimit, wait, watch, tracedump, exit, tee, echo, true,
+ * false or : was called and executes it. The status of the builtin is
+ * stored in last_status. timeout is a prefix rather than a builtin:
+ * strip_timeout takes it off first, and the command then always runs a
+ * program, so this is not called.
+ *
+ * Parameters:
+ *  - no_redirect: an array containing all the elements of argv except the
+ * redirect symbols and their accompanying files
+ *  - tokens: an array containing the parsed inputs, including the filepath
+ *  - input_file: the input redirect, or "stdin" if there is none
+ *  - output_file: the output redirect, or "stdout" if there is none
+ *  - is_append: 1 if the output redirect is an append (>>)
+ *  - is_background: a pointer to an int that tells if it is a background
+ * process or not
+ *
+ * Returns:
+ *  - 1 if a builtin was called and 0 otherwise
+ */
+int check_sys_cmds(char *no_redirect[], char *tokens[], char *input_file[],
+                   char *output_file[], int is_append, int *is_background) {
     if (strcmp(no_redirect[0], "cd") == 0 &&
         strcmp(tokens[0], "/bin/cd") != 0) {
         if (!no_redirect[1]) {
             /* if cd is not followed by anything and is builtin */
             fprintf(stderr, "cd: syntax error \n");
+            last_status = 1;
         } else {
             int cd_err = chdir(no_redirect[1]);
             if (cd_err == -1) {
                 perror("cd");
+                last_status = 1;
             }
         }
         return 1;
@@ -207,10 +582,12 @@ int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
         if (!no_redirect[1]) {
             /* if ln is not followed by anything and is builtin */
             fprintf(stderr, "ln: syntax error \n");
+            last_status = 1;
         } else {
             int ln_err = link(no_redirect[1], no_redirect[2]);
             if (ln_err == -1) {
                 perror("ln");
+                last_status = 1;
             }
         }
         return 1;
@@ -220,20 +597,66 @@ int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
         if (!no_redirect[1]) {
             /* if rm is not followed by anything and is builtin */
             fprintf(stderr, "rm: syntax error \n");
+            last_status = 1;
         } else {
             int rm_err = unlink(no_redirect[1]);
             if (rm_err == -1) {
                 perror("rm");
+                last_status = 1;
             }
         }
         return 1;
 
+    } else if (is_test_command(tokens[0])) {
+        last_status = run_test(no_redirect);
+        return 1;
+
     } else if (strcmp(no_redirect[0], "jobs") == 0) {
         // treating "jobs" like other system commands
-        if (no_redirect[1]) {
+        if (!no_redirect[1]) {
+            jobs(job_list);
+        } else if (strcmp(no_redirect[1], "-v") == 0 && !no_redirect[2]) {
+            if (jobs_usage(job_list, 0) == -1) {
+                last_status = 1;
+            }
+        } else if (strcmp(no_redirect[1], "--top") == 0 && !no_redirect[2]) {
+            // refreshed every second until ctrl-c is pressed, the samples
+            // keep their descriptors open in between
+            int clear = isatty(1);
+            follow_interrupted = 0;
+            install_handler(SIGINT, stop_following);
+            while (!follow_interrupted) {
+                reaper();
+                start_queued_jobs();
+                if (clear) {
+                    fputs("\033[H\033[2J", stdout);
+                }
+                long long sample_start = monotonic_ms();
+                int sampled = jobs_usage(job_list, 1);
+                if (sampled == -1) {
+                    last_status = 1;
+                    break;
+                }
+                fprintf(stdout,
+                        "%d processes sampled in %lld ms, CTRL C stops \n",
+                        sampled, monotonic_ms() - sample_start);
+                fflush(stdout);
+
+                // jobs that exit in the meantime are reaped right away
+                long long next = sample_start + 1000;
+                long long left;
+                while (!follow_interrupted &&
+                       (left = next - monotonic_ms()) > 0) {
+                    if (run_events((int)left) == -1) {
+                        follow_interrupted = 1;
+                    }
+                }
+            }
+            install_handler(SIGINT, SIG_IGN);
+        } else {
             fprintf(stderr, "jobs: syntax error \n");
+            last_status = 1;
         }
-        jobs(job_list);
         return 1;
 
     } else if (strcmp(no_redirect[0], "fg") == 0) {
@@ -245,6 +668,7 @@ int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
         int status;
         if (!no_redirect[1]) {
             fprintf(stderr, "fg: syntax error \n");
+            last_status = 1;
         } else {
             while (no_redirect[1][i]) {
                 jobid[j] = no_redirect[1][i];
@@ -255,32 +679,71 @@ int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
             pid_t theprocessid = get_job_pid(job_list, thejobid);
             if (theprocessid == -1) {
                 fprintf(stderr, "job not found \n");
+                last_status = 1;
+                return 1;
+            }
+            if (get_job_state(job_list, thejobid) == DONE) {
+                fprintf(stderr, "fg: job has finished \n");
+                last_status = 1;
                 return 1;
             }
+            if (get_job_state(job_list, thejobid) == QUEUED) {
+                // run it now, ahead of the queue and over the limit
+                if (start_queued_job_now(thejobid, 1) == -1) {
+                    last_status = 1;
+                }
+                return 1;
+            }
+            // a spooled job's output is shown while it is in the foreground
+            spool_t *spool = get_job_spool(job_list, thejobid);
+            if (spool != NULL) {
+                unsigned long long offset = 0;
+                fflush(stdout);
+                spool_print(spool, &offset, 1);
+                spool_attach(spool, 1);
+            }
             
            // update_job_jid(job_list, thejobid, RUNNING);
             kill(-theprocessid, SIGCONT);
-            tcsetpgrp(0, theprocessid);
+            give_terminal(theprocessid);
             
 
-            int wait_err = waitpid(theprocessid, &status, WUNTRACED);
+            int wait_err = wait_job(theprocessid, &status);
+            if (spool != NULL) {
+                // show what is left in the pipe, then stop copying
+                spool_flush(spool);
+                spool_attach(spool, -1);
+            }
             if (wait_err == -1) {
                 perror("waitpid");
+                last_status = 1;
             } else if (WIFSIGNALED(status)) {
                 // terminated by a signal
-                fprintf(stdout, "[%d] (%d) terminated by signal %d\n",
-                        thejobid, wait_err, WTERMSIG(status));
+                last_status = 128 + WTERMSIG(status);
+                fprintf(stdout, "[%d] (%d) %sterminated by signal %d\n",
+                        thejobid, wait_err, timeout_note(theprocessid),
+                        WTERMSIG(status));
                 remove_job_jid(job_list, thejobid);
+                disarm_timeout(theprocessid);
                 
             } else if (WIFSTOPPED(status)) {
                 // stopped
+                last_status = 128 + WSTOPSIG(status);
                 fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
                         thejobid, wait_err, WSTOPSIG(status));
                 update_job_jid(job_list, thejobid, STOPPED);
             }else if(WIFEXITED(status)){
+                last_status = WEXITSTATUS(status);
+                if (timeout_expired(theprocessid)) {
+                    fprintf(stdout,
+                            "[%d] (%d) timed out, terminated with exit status "
+                            "%d\n",
+                            thejobid, wait_err, WEXITSTATUS(status));
+                }
                 remove_job_jid(job_list, thejobid);
+                disarm_timeout(theprocessid);
             }
-            tcsetpgrp(0, getpgrp());
+            give_terminal(getpgrp());
             //remove_job_jid(job_list, thejobid);
 
             return 1;
@@ -294,6 +757,7 @@ int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
         int status;
         if (!no_redirect[1]) {
             fprintf(stderr, "bg: syntax error \n");
+            last_status = 1;
         } else {
             while (no_redirect[1][i]) {
                 jobid[j] = no_redirect[1][i];
@@ -304,72 +768,462 @@ int check_sys_cmds(char *no_redirect[], char *tokens[], int *is_background) {
             pid_t theprocessid = get_job_pid(job_list, thejobid);
             if (theprocessid == -1) {
                 fprintf(stderr, "job not found \n");
+                last_status = 1;
+                return 1;
+            }
+            if (get_job_state(job_list, thejobid) == DONE) {
+                fprintf(stderr, "bg: job has finished \n");
+                last_status = 1;
+                return 1;
+            }
+            if (get_job_state(job_list, thejobid) == QUEUED) {
+                // start it now, ahead of the queue and over the limit
+                if (start_queued_job_now(thejobid, 0) == -1) {
+                    last_status = 1;
+                }
+                *is_background = 2;
                 return 1;
             }
             kill(-theprocessid, SIGCONT);
             update_job_jid(job_list, thejobid, RUNNING);
             *is_background = 2;
         }
-        tcsetpgrp(0, getpgrp());
+        give_terminal(getpgrp());
 
         return 1;
     }
 
-    else if (strcmp(no_redirect[0], "exit") == 0) {
-        cleanup_job_list(job_list);
-        exit(0);
-    }
-
-    return 0;
-}
-
-/*
- * Checks if a redirect symbol was used and then closes and opens the
- * appropriate file descriptor with the new specified file
- *
- * Parameters:
- *  - input_file: the array containing a new input file, if specified, or
- * "stdin" otherwise
- *  - output_file: the array containing a new output file, if specified, or
- * "stdout" otherwise
- *  - is_append: an int that specifies whether the output file should be
- * appended
- *
- * Returns:
- *  - nothing
- */
-void redirect_file(char *input_file[], char *output_file[], int is_append) {
-    if (strcmp(input_file[0], "stdin") != 0) {
-        /* changing the input file */
-        close(0);
-        if (open(input_file[0], O_RDWR, S_IRWXU) == -1) {
-            perror("input error");
-            cleanup_job_list(job_list);
-            exit(1);
+    else if (strcmp(no_redirect[0], "kill") == 0 &&
+             strcmp(tokens[0], "/bin/kill") != 0) {
+        // kill [-SIG] %N %M-%K %all PID..., all the jobs are signalled in
+        // one pass over the job list
+        int sig = SIGTERM;
+        int i = 1;
+        if (no_redirect[i] && no_redirect[i][0] == '-') {
+            sig = parse_signal(&no_redirect[i][1]);
+            if (sig == -1) {
+                fprintf(stderr, "kill: unknown signal %s \n",
+                        &no_redirect[i][1]);
+                last_status = 1;
+                return 1;
+            }
+            i++;
         }
-    }
-    if (strcmp(output_file[0], "stdout") != 0 && is_append == 0) {
-        /* changing the output file wihtout the append flag */
-        close(1);
-        if (open(output_file[0], O_CREAT | O_TRUNC | O_RDWR, S_IRWXU) == -1) {
-            perror("output error");
-            cleanup_job_list(job_list);
-            exit(1);
+        if (!no_redirect[i]) {
+            fprintf(stderr,
+                    "kill: usage: kill [-SIG] %%N|%%M-%%K|%%all|pid... \n");
+            last_status = 1;
+            return 1;
         }
 
-    } else if (strcmp(output_file[0], "stdout") != 0 && is_append == 1) {
-        /* changing the output file with the append flag */
-        close(1);
-        if (open(output_file[0], O_CREAT | O_APPEND | O_RDWR, S_IRWXU) == -1) {
-            perror("append error");
-            cleanup_job_list(job_list);
-            exit(1);
+        int n_args = 0;
+        while (no_redirect[i + n_args]) {
+            n_args++;
+        }
+        jid_range_t *ranges =
+            (jid_range_t *)malloc(sizeof(jid_range_t) * (size_t)n_args);
+        int *matched = (int *)malloc(sizeof(int) * (size_t)n_args);
+        char **specs = (char **)malloc(sizeof(char *) * (size_t)n_args);
+        if (ranges == NULL || matched == NULL || specs == NULL) {
+            perror("malloc");
+            free(ranges);
+            free(matched);
+            free(specs);
+            last_status = 1;
+            return 1;
         }
-    }
-}
 
-/*
- * Checks if a redirect symbol was the first element in the tokens array,
+        int n_ranges = 0;
+        last_status = 0;
+        for (; no_redirect[i]; i++) {
+            char *arg = no_redirect[i];
+            char *end;
+            if (arg[0] != '%') {
+                // a plain PID is signalled directly, after the jobs
+                continue;
+            }
+            if (strcmp(arg, "%all") == 0) {
+                ranges[n_ranges].first = 0;
+                ranges[n_ranges].last = INT_MAX;
+            } else {
+                long first = strtol(&arg[1], &end, 10);
+                long last = first;
+                int valid = end != &arg[1];
+                if (valid && end[0] == '-' && end[1] == '%') {
+                    char *start = &end[2];
+                    last = strtol(start, &end, 10);
+                    valid = end != start;
+                }
+                if (!valid || *end != '\0' || first < 0 || last < first ||
+                    last > INT_MAX) {
+                    fprintf(stderr, "kill: bad job %s \n", arg);
+                    last_status = 1;
+                    continue;
+                }
+                ranges[n_ranges].first = (int)first;
+                ranges[n_ranges].last = (int)last;
+            }
+            specs[n_ranges++] = arg;
+        }
+
+        if (n_ranges > 0) {
+            signal_jobs(job_list, ranges, n_ranges, sig, matched);
+            for (int r = 0; r < n_ranges; r++) {
+                // %all matching nothing is not an error
+                if (matched[r] == 0 && ranges[r].last != INT_MAX) {
+                    fprintf(stderr, "kill: %s: job not found \n", specs[r]);
+                    last_status = 1;
+                }
+            }
+        }
+        for (i = i - n_args; no_redirect[i]; i++) {
+            if (no_redirect[i][0] == '%') {
+                continue;
+            }
+            char *end;
+            long pid = strtol(no_redirect[i], &end, 10);
+            if (end == no_redirect[i] || *end != '\0' || pid <= 0 ||
+                pid > INT_MAX) {
+                fprintf(stderr, "kill: bad pid %s \n", no_redirect[i]);
+                last_status = 1;
+            } else if (kill((pid_t)pid, sig) == -1) {
+                fprintf(stderr, "kill: %ld: %s \n", pid, strerror(errno));
+                last_status = 1;
+            }
+        }
+        free(ranges);
+        free(matched);
+        free(specs);
+        return 1;
+    }
+
+    else if (strcmp(tokens[0], "tee") == 0) {
+        // the builtin runs inside the shell, so its redirects are opened as
+        // separate descriptors instead of replacing the shell's stdin/stdout
+        int in_fd = 0;
+        int out_fd = 1;
+        if (strcmp(input_file[0], "stdin") != 0) {
+            in_fd = open(input_file[0], O_RDONLY);
+            if (in_fd == -1) {
+                perror("input error");
+                return 1;
+            }
+        }
+        out_fd = builtin_output(output_file, is_append);
+        if (out_fd == -1) {
+            if (in_fd != 0) {
+                close(in_fd);
+            }
+            last_status = 1;
+            return 1;
+        }
+
+        fflush(stdout);
+        last_status = run_tee(no_redirect, in_fd, out_fd);
+
+        if (in_fd != 0) {
+            close(in_fd);
+        }
+        if (out_fd != 1) {
+            close(out_fd);
+        }
+        return 1;
+    }
+
+    else if (strcmp(tokens[0], "echo") == 0) {
+        int out_fd = builtin_output(output_file, is_append);
+        if (out_fd == -1) {
+            last_status = 1;
+            return 1;
+        }
+        int i = 1;
+        int newline = 1;
+        if (no_redirect[1] && strcmp(no_redirect[1], "-n") == 0) {
+            newline = 0;
+            i++;
+        }
+
+        // built in one buffer so the line is a single write
+        char line[4096];
+        size_t len = 0;
+        for (; no_redirect[i]; i++) {
+            size_t word_len = strlen(no_redirect[i]);
+            if (len + word_len + 2 > sizeof(line)) {
+                // flush what fits so far, the line is just split into writes
+                fflush(stdout);
+                write(out_fd, line, len);
+                len = 0;
+            }
+            if (word_len + 2 > sizeof(line)) {
+                write(out_fd, no_redirect[i], word_len);
+            } else {
+                memcpy(&line[len], no_redirect[i], word_len);
+                len += word_len;
+            }
+            if (no_redirect[i + 1]) {
+                line[len++] = ' ';
+            }
+        }
+        if (newline) {
+            line[len++] = '\n';
+        }
+        fflush(stdout);
+        if (write(out_fd, line, len) == -1) {
+            perror("echo");
+            last_status = 1;
+        }
+        if (out_fd != 1) {
+            close(out_fd);
+        }
+        return 1;
+
+    } else if (strcmp(tokens[0], "true") == 0 ||
+               strcmp(tokens[0], ":") == 0) {
+        return 1;
+
+    } else if (strcmp(tokens[0], "false") == 0) {
+        last_status = 1;
+        return 1;
+    }
+
+    else if (strcmp(no_redirect[0], "set") == 0) {
+        if (!no_redirect[1]) {
+            /* with no arguments, list the options */
+            printf("trace %s\n", trace_enabled ? "on" : "off");
+            printf("spool %s\n", spool_enabled ? "on" : "off");
+        } else if (!no_redirect[2] || (strcmp(no_redirect[1], "-o") != 0 &&
+                                       strcmp(no_redirect[1], "+o") != 0)) {
+            fprintf(stderr, "set: syntax error \n");
+            last_status = 1;
+        } else {
+            set_option(no_redirect[2], no_redirect[1][0] == '-');
+        }
+        return 1;
+
+    } else if (strcmp(no_redirect[0], "joblog") == 0) {
+        int follow = no_redirect[1] && no_redirect[2] &&
+                     strcmp(no_redirect[2], "-f") == 0;
+        if (!no_redirect[1] || no_redirect[1][0] != '%' ||
+            (no_redirect[2] && !follow) || (follow && no_redirect[3])) {
+            fprintf(stderr, "joblog: syntax error \n");
+            last_status = 1;
+            return 1;
+        }
+        int thejobid = atoi(&no_redirect[1][1]);
+        spool_t *spool = get_job_spool(job_list, thejobid);
+        if (spool == NULL) {
+            if (get_job_pid(job_list, thejobid) == -1) {
+                fprintf(stderr, "job not found \n");
+            } else {
+                fprintf(stderr, "joblog: the job's output is not spooled \n");
+            }
+            last_status = 1;
+            return 1;
+        }
+        int out_fd = builtin_output(output_file, is_append);
+        if (out_fd == -1) {
+            last_status = 1;
+            return 1;
+        }
+
+        fflush(stdout);
+        unsigned long long offset = 0;
+        unsigned long long dropped = spool_print(spool, &offset, out_fd);
+        if (follow) {
+            // until the job closes its output or ctrl-c is pressed
+            follow_interrupted = 0;
+            install_handler(SIGINT, stop_following);
+            while (spool_is_open(spool) && !follow_interrupted) {
+                if (run_events(-1) == -1) {
+                    break;
+                }
+                dropped += spool_print(spool, &offset, out_fd);
+            }
+            install_handler(SIGINT, SIG_IGN);
+        }
+        if (dropped > 0) {
+            fprintf(stderr, "joblog: %llu bytes of older output were lost \n",
+                    dropped);
+        }
+        if (out_fd != 1) {
+            close(out_fd);
+        }
+
+        if (get_job_state(job_list, thejobid) == DONE) {
+            // its output has been read, so the job can go
+            remove_job_jid(job_list, thejobid);
+        }
+        return 1;
+
+    } else if (strcmp(no_redirect[0], "joblimit") == 0) {
+        if (!no_redirect[1]) {
+            print_job_limit(count_running_jobs(job_list));
+        } else if (no_redirect[2] || set_job_limit(no_redirect[1]) == -1) {
+            fprintf(stderr,
+                    "joblimit: expected a count, cores, load or off \n");
+            last_status = 1;
+        } else {
+            // a higher limit lets waiting jobs start
+            start_queued_jobs();
+        }
+        return 1;
+
+    } else if (strcmp(no_redirect[0], "wait") == 0) {
+        // until every running and queued job has finished, stopped jobs
+        // are not waited for
+        init_events();
+        while (1) {
+            reaper();
+            start_queued_jobs();
+            if (count_running_jobs(job_list) == 0 &&
+                next_queued_job(job_list) == -1) {
+                break;
+            }
+            if (run_events(-1) == -1) {
+                last_status = 1;
+                break;
+            }
+        }
+        return 1;
+
+    } else if (strcmp(no_redirect[0], "watch") == 0) {
+        // watch [-d ms] -p path... -- command, until ctrl-c is pressed
+        int debounce_ms = WATCH_DEBOUNCE_MS;
+        int i = 1;
+        if (no_redirect[i] && strcmp(no_redirect[i], "-d") == 0 &&
+            no_redirect[i + 1]) {
+            char *end;
+            long value = strtol(no_redirect[i + 1], &end, 10);
+            if (*end != '\0' || value < 0 || value > 3600000) {
+                fprintf(stderr, "watch: bad delay %s \n", no_redirect[i + 1]);
+                last_status = 1;
+                return 1;
+            }
+            debounce_ms = (int)value;
+            i += 2;
+        }
+        int first_path = i + 1;
+        int separator = first_path;
+        while (no_redirect[separator] &&
+               strcmp(no_redirect[separator], "--") != 0) {
+            separator++;
+        }
+        if (!no_redirect[i] || strcmp(no_redirect[i], "-p") != 0 ||
+            separator == first_path || !no_redirect[separator] ||
+            !no_redirect[separator + 1]) {
+            fprintf(stderr,
+                    "watch: usage: watch [-d ms] -p path... -- command \n");
+            last_status = 1;
+            return 1;
+        }
+        // a command cut short would run something else than was typed
+        int n_words = 0;
+        while (no_redirect[separator + 1 + n_words]) {
+            n_words++;
+        }
+        if (n_words > WATCH_MAX_WORDS) {
+            fprintf(stderr, "watch: usage: the command has more than %d words "
+                            "\n",
+                    WATCH_MAX_WORDS);
+            last_status = 1;
+            return 1;
+        }
+
+        watch_t *watch =
+            watch_open(&no_redirect[first_path], separator - first_path);
+        if (watch == NULL) {
+            last_status = 1;
+            return 1;
+        }
+        fprintf(stdout, "watch: %d directories and files, CTRL C stops \n",
+                watch_count(watch));
+
+        // the command runs as a background job so ctrl-c only reaches the
+        // shell, and the last run is left running as an ordinary job
+        char **command = &no_redirect[separator + 1];
+        follow_interrupted = 0;
+        install_handler(SIGINT, stop_following);
+        int run = start_watched_run(command, input_file, output_file,
+                                    is_append);
+        while (!follow_interrupted) {
+            int timeout_ms;
+            if (watch_settled(watch, debounce_ms, &timeout_ms)) {
+                end_watched_run(run);
+                run = start_watched_run(command, input_file, output_file,
+                                        is_append);
+                continue;
+            }
+            if (run_events(timeout_ms) == -1) {
+                break;
+            }
+            reaper();
+            start_queued_jobs();
+        }
+        install_handler(SIGINT, SIG_IGN);
+        watch_close(watch);
+        last_status = 0;
+        return 1;
+
+    } else if (strcmp(no_redirect[0], "tracedump") == 0) {
+        trace_dump(no_redirect[1] ? no_redirect[1] : "-");
+        return 1;
+    }
+
+    else if (strcmp(no_redirect[0], "exit") == 0) {
+        cleanup_job_list(job_list);
+        exit(0);
+    }
+
+    return 0;
+}
+
+/*
+ * Checks if a redirect symbol was used and then closes and opens the
+ * appropriate file descriptor with the new specified file
+ *
+ * Parameters:
+ *  - input_file: the array containing a new input file, if specified, or
+ * "stdin" otherwise
+ *  - output_file: the array containing a new output file, if specified, or
+ * "stdout" otherwise
+ *  - is_append: an int that specifies whether the output file should be
+ * appended
+ *
+ * Returns:
+ *  - nothing
+ */
+void redirect_file(char *input_file[], char *output_file[], int is_append) {
+    if (strcmp(input_file[0], "stdin") != 0) {
+        /* changing the input file */
+        close(0);
+        if (open(input_file[0], O_RDWR, S_IRWXU) == -1) {
+            perror("input error");
+            cleanup_job_list(job_list);
+            exit(1);
+        }
+    }
+    if (strcmp(output_file[0], "stdout") != 0 && is_append == 0) {
+        /* changing the output file wihtout the append flag */
+        close(1);
+        if (open(output_file[0], O_CREAT | O_TRUNC | O_RDWR, S_IRWXU) == -1) {
+            perror("output error");
+            cleanup_job_list(job_list);
+            exit(1);
+        }
+
+    } else if (strcmp(output_file[0], "stdout") != 0 && is_append == 1) {
+        /* changing the output file with the append flag */
+        close(1);
+        if (open(output_file[0], O_CREAT | O_APPEND | O_RDWR, S_IRWXU) == -1) {
+            perror("append error");
+            cleanup_job_list(job_list);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Checks if a redirect symbol was the first element in the tokens array,
  * and then resets the tokens array to start after the symbol and its
  * following file. This makes it so that tokens[0] is always the filepath of
  * the program to execute.
@@ -388,23 +1242,150 @@ void get_filepath(char *tokens[]) {
 }
 
 /*
- * Installs the signal handler so that we can handle the signals
+ * Converts a signal name or number (9, KILL, SIGKILL) to the signal number
  *
  * Parameters:
- *  - sig: an int representing the signal
- * - handler: the handler we want to install
+ *  - str: the signal as typed
  *
  * Returns:
- *  - int
+ *  - the signal number, or -1 if it is unknown
  */
-int install_handler(int sig, void (*handler)(int)) {
-    if (signal(sig, handler) != SIG_ERR) {
-        return 0;
+int parse_signal(const char *str) {
+    static const struct {
+        const char *name;
+        int sig;
+    } names[] = {
+        {"HUP", SIGHUP},   {"INT", SIGINT},       {"QUIT", SIGQUIT},
+        {"ILL", SIGILL},   {"TRAP", SIGTRAP},     {"ABRT", SIGABRT},
+        {"BUS", SIGBUS},   {"FPE", SIGFPE},       {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"SEGV", SIGSEGV},     {"USR2", SIGUSR2},
+        {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},     {"TERM", SIGTERM},
+        {"CHLD", SIGCHLD}, {"CONT", SIGCONT},     {"STOP", SIGSTOP},
+        {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},     {"TTOU", SIGTTOU},
+        {"URG", SIGURG},   {"XCPU", SIGXCPU},     {"XFSZ", SIGXFSZ},
+        {"VTALRM", SIGVTALRM}, {"PROF", SIGPROF}, {"WINCH", SIGWINCH},
+        {"IO", SIGIO},     {"SYS", SIGSYS},
+    };
+
+    char *end;
+    long number = strtol(str, &end, 10);
+    if (end != str && *end == '\0') {
+        return number > 0 && number < NSIG ? (int)number : -1;
     }
 
+    if (strncasecmp(str, "SIG", 3) == 0) {
+        str += 3;
+    }
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(str, names[i].name) == 0) {
+            return names[i].sig;
+        }
+    }
     return -1;
 }
 
+/*
+ * Parses a duration such as 10, 2.5, 30s, 5m, 1h or 1d (seconds by default)
+ *
+ * Parameters:
+ *  - str: the duration as typed
+ *
+ * Returns:
+ *  - the duration in nanoseconds, or -1 if it is not valid
+ */
+long long parse_duration(const char *str) {
+    char *end;
+    double seconds = strtod(str, &end);
+    if (end == str || !isfinite(seconds) || seconds < 0) {
+        return -1;
+    }
+
+    if (strcmp(end, "m") == 0) {
+        seconds *= 60;
+    } else if (strcmp(end, "h") == 0) {
+        seconds *= 60 * 60;
+    } else if (strcmp(end, "d") == 0) {
+        seconds *= 60 * 60 * 24;
+    } else if (*end != '\0' && strcmp(end, "s") != 0) {
+        return -1;
+    }
+    // too long to count in nanoseconds
+    if (seconds * 1e9 >= (double)LLONG_MAX) {
+        return -1;
+    }
+    return (long long)(seconds * 1e9);
+}
+
+/*
+ * Handles a "timeout [-s SIG] [-k grace] DURATION" prefix by removing it from
+ * no_redirect and tokens, so that the rest of the line runs as a normal
+ * command, and storing the time limit in the remaining parameters
+ *
+ * Parameters:
+ *  - no_redirect: the command's arguments without redirects
+ *  - tokens: an array containing the parsed inputs, including the filepath
+ *  - duration_ns: set to the time limit in nanoseconds
+ *  - sig: set to the signal to send when the time limit is reached
+ *  - grace_ns: set to the time after which SIGKILL follows, 0 for never
+ *
+ * Returns:
+ *  - 1 if there was a timeout prefix, 0 if there was not, -1 if it was invalid
+ */
+int strip_timeout(char *no_redirect[], char *tokens[], long long *duration_ns,
+                  int *sig, long long *grace_ns) {
+    if (strcmp(tokens[0], "timeout") != 0) {
+        return 0;
+    }
+
+    *sig = SIGTERM;
+    *grace_ns = 0;
+    int i = 1;
+    while (no_redirect[i] && no_redirect[i + 1]) {
+        if (strcmp(no_redirect[i], "-s") == 0) {
+            *sig = parse_signal(no_redirect[i + 1]);
+            if (*sig == -1) {
+                fprintf(stderr, "timeout: invalid signal %s \n",
+                        no_redirect[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(no_redirect[i], "-k") == 0) {
+            *grace_ns = parse_duration(no_redirect[i + 1]);
+            if (*grace_ns == -1) {
+                fprintf(stderr, "timeout: invalid duration %s \n",
+                        no_redirect[i + 1]);
+                return -1;
+            }
+        } else {
+            break;
+        }
+        i += 2;
+    }
+
+    if (!no_redirect[i] || !no_redirect[i + 1]) {
+        fprintf(stderr, "timeout: syntax error \n");
+        return -1;
+    }
+    *duration_ns = parse_duration(no_redirect[i]);
+    if (*duration_ns == -1) {
+        fprintf(stderr, "timeout: invalid duration %s \n", no_redirect[i]);
+        return -1;
+    }
+    i++;
+
+    // shift the command to the front, argv[0] is only the file name
+    tokens[0] = no_redirect[i];
+    char *occurrence = strrchr(tokens[0], '/');
+    no_redirect[0] = occurrence != NULL ? occurrence + 1 : tokens[0];
+    int j = 1;
+    for (i++; no_redirect[i]; i++, j++) {
+        no_redirect[j] = no_redirect[i];
+    }
+    for (; j < i; j++) {
+        no_redirect[j] = NULL;
+    }
+    return 1;
+}
+
 /*
  * Ignores the signals so that the shell does not accidentally exit prematurely
  *
@@ -456,10 +1437,32 @@ void reset_signals() {
     if (install_handler(SIGTTOU, SIG_DFL))
         perror("Warning: could not install handler for SIGTTOU");
 
-    // Restore signal mask to previous value
+    // Restore signal mask to previous value, the shell blocks SIGCHLD for
+    // its event loop but the new program should not inherit that
+    sigdelset(&old, SIGCHLD);
     sigprocmask(SIG_SETMASK, &old, NULL);
 }
 
+
+/*
+ * Removes a background job that has terminated. A spooled job is kept as
+ * Done instead, until its output is read with joblog.
+ *
+ * Parameters:
+ *  - jid: the job ID of the job
+ *
+ * Returns:
+ *  - nothing
+ */
+void finish_job(int jid) {
+    if (get_job_spool(job_list, jid) != NULL) {
+        // keep the output until it is read with joblog
+        update_job_jid(job_list, jid, DONE);
+    } else {
+        remove_job_jid(job_list, jid);
+    }
+}
+
 /*
  * Goes through each child process and checks to make sure that if something has
  * changed status, it is handled appropriately and removed form the job list, or
@@ -475,18 +1478,29 @@ void reaper() {
     while ((wret = waitpid(-1, &wstatus, WNOHANG | WUNTRACED | WCONTINUED)) >
            0) {
         int jid = get_job_jid(job_list, wret);
+        if (jid == -1) {
+            // extra stage processes (e.g. a tee stage) share their job's
+            // process group but are not in the job list themselves
+            if (stray_children > 0 &&
+                (WIFEXITED(wstatus) || WIFSIGNALED(wstatus))) {
+                stray_children--;
+            }
+            continue;
+        }
 
         if (WIFEXITED(wstatus)) {
             // terminated normally
-            fprintf(stdout, "[%d] (%d) terminated with exit status %d\n", jid,
-                    wret, WEXITSTATUS(wstatus));
-            remove_job_jid(job_list, jid);
+            fprintf(stdout, "[%d] (%d) %sterminated with exit status %d\n",
+                    jid, wret, timeout_note(wret), WEXITSTATUS(wstatus));
+            finish_job(jid);
+            disarm_timeout(wret);
 
         } else if (WIFSIGNALED(wstatus)) {
             // terminated by a signal
-            fprintf(stdout, "[%d] (%d) terminated by signal %d\n", jid, wret,
-                    WTERMSIG(wstatus));
-            remove_job_jid(job_list, jid);
+            fprintf(stdout, "[%d] (%d) %sterminated by signal %d\n", jid,
+                    wret, timeout_note(wret), WTERMSIG(wstatus));
+            finish_job(jid);
+            disarm_timeout(wret);
         }
         if (WIFSTOPPED(wstatus)) {
             // stopped
@@ -502,31 +1516,1052 @@ void reaper() {
     }
 }
 
-int main() {
-    
-    char buffer[1024];
-    char *tokens[512];
-    char *argv[512];
-    char *no_redirect[512];
-    char *input_file[50];
-    char *output_file[50];
-    int is_append;
-    int is_background_job = 0;
-    job_list = init_job_list();
-    job_number = 1;
-    parent_pgid = getpid();
-    ignore_signals();
+/*
+ * Builds the environment of a command that has NAME=value words before it:
+ * the shell's environment with those values added or replacing its own
+ *
+ * Parameters:
+ *  - assignments: the NAME=value words, NULL-terminated
+ *
+ * Returns:
+ *  - a NULL-terminated array for the caller to free (but not its strings),
+ * NULL on failure
+ */
+char **command_environment(char *assignments[]) {
+    int n_env = 0;
+    while (environ[n_env] != NULL) {
+        n_env++;
+    }
+    int n_assignments = 0;
+    while (assignments[n_assignments] != NULL) {
+        n_assignments++;
+    }
+    char **envp = (char **)malloc(sizeof(char *) *
+                                  (size_t)(n_env + n_assignments + 1));
+    if (envp == NULL) {
+        return NULL;
+    }
 
-    while (1) { /*inifinite while loop*/
-        if (job_number > 1) {
-            reaper();
+    // a name set again later on the line, or by the line, is left out
+    int n = 0;
+    for (int i = 0; i < n_env + n_assignments; i++) {
+        char *entry = i < n_env ? environ[i] : assignments[i - n_env];
+        size_t name_len = strcspn(entry, "=") + 1;
+        int replaced = 0;
+        for (int j = i < n_env ? 0 : i - n_env + 1; j < n_assignments; j++) {
+            if (strncmp(assignments[j], entry, name_len) == 0) {
+                replaced = 1;
+                break;
+            }
         }
-#ifdef PROMPT
-        int err = printf("33sh> ");
-        if (err < 0) {
-            /* handle a write error */
-            fprintf(stderr, "Writing to terminal failed: %i\n", err);
-            return 1;
+        if (!replaced) {
+            envp[n++] = entry;
+        }
+    }
+    envp[n] = NULL;
+    return envp;
+}
+
+/*
+ * Starts a command with posix_spawn, for when the shell is not interactive.
+ * The child gets its own process group, the default signal dispositions and
+ * a mask without SIGCHLD through spawn attributes that are set up once, so
+ * the shell makes no setpgid, signal or terminal calls for it. Redirects are
+ * opened by the shell and handed over as descriptors.
+ *
+ * Parameters:
+ *  - tokens: an array containing the parsed inputs, including the filepath
+ *  - no_redirect: the command's arguments without redirects
+ *  - input_file: the input redirect, or "stdin" if there is none
+ *  - output_file: the output redirect, or "stdout" if there is none
+ *  - is_append: 1 if the output redirect is an append (>>)
+ *  - assignments: the NAME=value words for the command's environment,
+ * NULL-terminated
+ *
+ * Returns:
+ *  - the PID of the child, -1 on failure, with last_status set (127 if the
+ * program could not be run)
+ */
+pid_t spawn_command(char *tokens[], char *no_redirect[], char *input_file[],
+                    char *output_file[], int is_append,
+                    char *assignments[]) {
+    static posix_spawnattr_t attr;
+    static int attr_ready = 0;
+    if (!attr_ready) {
+        // the shell ignores these, and blocks SIGCHLD for its event loop
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        sigaddset(&defaults, SIGINT);
+        sigaddset(&defaults, SIGTSTP);
+        sigaddset(&defaults, SIGTTOU);
+        sigset_t mask;
+        sigprocmask(SIG_BLOCK, NULL, &mask);
+        sigdelset(&mask, SIGCHLD);
+
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                            POSIX_SPAWN_SETSIGMASK |
+                                            POSIX_SPAWN_SETPGROUP);
+        attr_ready = 1;
+    }
+
+    // the same files and modes as redirect_file
+    uint64_t stage_start = TRACE_BEGIN();
+    int in_fd = -1;
+    int out_fd = -1;
+    if (strcmp(input_file[0], "stdin") != 0) {
+        in_fd = open(input_file[0], O_RDWR | O_CLOEXEC, S_IRWXU);
+        if (in_fd == -1) {
+            perror("input error");
+            last_status = 1;
+            return -1;
+        }
+    }
+    if (strcmp(output_file[0], "stdout") != 0) {
+        int flags =
+            O_CREAT | O_RDWR | O_CLOEXEC | (is_append ? O_APPEND : O_TRUNC);
+        out_fd = open(output_file[0], flags, S_IRWXU);
+        if (out_fd == -1) {
+            perror(is_append ? "append error" : "output error");
+            if (in_fd != -1) {
+                close(in_fd);
+            }
+            last_status = 1;
+            return -1;
+        }
+    }
+    TRACE_END(TRACE_REDIRECT_FILE, stage_start, tokens[0]);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *actions_ptr = NULL;
+    if (in_fd != -1 || out_fd != -1) {
+        posix_spawn_file_actions_init(&actions);
+        if (in_fd != -1) {
+            posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+        }
+        if (out_fd != -1) {
+            posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+        }
+        actions_ptr = &actions;
+    }
+
+    char **envp = environ;
+    if (assignments[0] != NULL) {
+        envp = command_environment(assignments);
+        if (envp == NULL) {
+            perror("malloc");
+            envp = environ;
+        }
+    }
+
+    pid_t pid;
+    stage_start = TRACE_BEGIN();
+    int err = posix_spawn(&pid, tokens[0], actions_ptr, &attr, no_redirect,
+                          envp);
+    if (envp != environ) {
+        free(envp);
+    }
+    TRACE_END(TRACE_FORK, stage_start, tokens[0]);
+    if (actions_ptr != NULL) {
+        posix_spawn_file_actions_destroy(actions_ptr);
+    }
+    if (in_fd != -1) {
+        close(in_fd);
+    }
+    if (out_fd != -1) {
+        close(out_fd);
+    }
+    if (err != 0) {
+        errno = err;
+        perror("execv");
+        last_status = 127;
+        return -1;
+    }
+    return pid;
+}
+
+// a <(cmd) or >(cmd) word: cmd runs on a pipe and the job gets the other
+// end of it as /dev/fd/N
+#define MAX_SUBSTITUTIONS 8
+struct substitution {
+    char *tokens[64];  // the inner command, NULL terminated
+    char words[1024];  // its words, copied out of the line
+    int is_output;  // 1 for >(cmd), which reads what the job writes
+    int fds[2];  // the pipe, -1 when closed
+    char path[32];  // the /dev/fd/N word the job gets
+    pid_t pid;  // the inner command's process, -1 if it is not running
+};
+typedef struct substitution substitution_t;
+
+/*
+ * Takes the <(cmd) and >(cmd) words out of a command line, each one becomes
+ * a single word that is set to the /dev/fd/N path once its pipe is opened.
+ * The inner command may span several words and use redirects, e.g.
+ * "<(/bin/sort -u names.txt)" or ">(/usr/bin/gzip > out.gz)".
+ *
+ * Parameters:
+ *  - tokens: the words of the line, rearranged in place
+ *  - argv: the words without the full filepath, rebuilt from tokens
+ *  - subs: where the substitutions are stored, MAX_SUBSTITUTIONS of them
+ *
+ * Returns:
+ *  - the number of substitutions, -1 on a syntax error
+ */
+int find_substitutions(char *tokens[], char *argv[], substitution_t subs[]) {
+    int n = 0;
+    int n_out = 0;
+    int i = 0;
+    for (; tokens[i] != NULL; i++) {
+        char *word = tokens[i];
+        if ((word[0] != '<' && word[0] != '>') || word[1] != '(') {
+            tokens[n_out++] = word;
+            continue;
+        }
+        if (n == MAX_SUBSTITUTIONS) {
+            fprintf(stderr, "syntax error: too many process substitutions \n");
+            return -1;
+        }
+
+        // the words up to the one ending with ) are the inner command
+        substitution_t *sub = &subs[n];
+        sub->is_output = word[0] == '>';
+        sub->fds[0] = -1;
+        sub->fds[1] = -1;
+        sub->pid = -1;
+        sub->path[0] = '\0';
+        size_t used = 0;
+        int n_words = 0;
+        int closed = 0;
+        word += 2;
+        while (1) {
+            size_t len = strlen(word);
+            if (len > 0 && word[len - 1] == ')') {
+                len--;
+                closed = 1;
+            }
+            if (len > 0) {
+                if (used + len + 1 > sizeof(sub->words) || n_words == 63) {
+                    fprintf(stderr, "syntax error: process substitution is "
+                                    "too long \n");
+                    return -1;
+                }
+                memcpy(&sub->words[used], word, len);
+                sub->words[used + len] = '\0';
+                sub->tokens[n_words++] = &sub->words[used];
+                used += len + 1;
+            }
+            if (closed || tokens[i + 1] == NULL) {
+                break;
+            }
+            word = tokens[++i];
+        }
+        sub->tokens[n_words] = NULL;
+        if (!closed || n_words == 0) {
+            fprintf(stderr, "syntax error: expected a command and ) after "
+                            "%c( \n", sub->is_output ? '>' : '<');
+            return -1;
+        }
+        tokens[n_out++] = sub->path;
+        n++;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    for (int j = 0; j < i; j++) {
+        tokens[j] = j < n_out ? tokens[j] : NULL;
+        argv[j] = tokens[j];
+    }
+    if (tokens[0] != NULL) {
+        char *occurrence = strrchr(tokens[0], '/');
+        argv[0] = occurrence != NULL ? occurrence + 1 : tokens[0];
+    }
+    return n;
+}
+
+/*
+ * Closes the shell's ends of the substitutions' pipes
+ *
+ * Parameters:
+ *  - subs: the substitutions
+ *  - n: how many there are
+ *
+ * Returns:
+ *  - nothing
+ */
+void close_substitutions(substitution_t subs[], int n) {
+    for (int i = 0; i < n; i++) {
+        for (int end = 0; end < 2; end++) {
+            if (subs[i].fds[end] != -1) {
+                close(subs[i].fds[end]);
+                subs[i].fds[end] = -1;
+            }
+        }
+    }
+}
+
+/*
+ * Opens the pipes of the substitutions and sets their /dev/fd/N words. Both
+ * ends are close-on-exec, the job clears the flag on its own end.
+ *
+ * Parameters:
+ *  - subs: the substitutions found by find_substitutions
+ *  - n: how many there are
+ *
+ * Returns:
+ *  - 0 on success, -1 on failure (with nothing left open)
+ */
+int open_substitutions(substitution_t subs[], int n) {
+    for (int i = 0; i < n; i++) {
+        if (pipe2(subs[i].fds, O_CLOEXEC) == -1) {
+            perror("pipe");
+            close_substitutions(subs, i);
+            return -1;
+        }
+        // the job reads what <(cmd) writes and writes what >(cmd) reads
+        snprintf(subs[i].path, sizeof(subs[i].path), "/dev/fd/%d",
+                 subs[i].fds[subs[i].is_output ? 1 : 0]);
+    }
+    return 0;
+}
+
+/*
+ * Starts the inner commands of the substitutions in the job's process group,
+ * so they are stopped, continued, killed and reaped with it, then closes the
+ * shell's ends of the pipes
+ *
+ * Parameters:
+ *  - subs: the substitutions, opened with open_substitutions
+ *  - n: how many there are
+ *  - pgid: the process group (and PID) of the job
+ *  - spool_fd: where the job's output is spooled, or -1
+ *
+ * Returns:
+ *  - nothing
+ */
+void start_substitutions(substitution_t subs[], int n, pid_t pgid,
+                         int spool_fd) {
+    for (int i = 0; i < n; i++) {
+        substitution_t *sub = &subs[i];
+        if ((sub->pid = fork()) == 0) {
+            setpgid(0, pgid);
+            reset_signals();
+            // the other pipes and the spool are close-on-exec
+            dup2(sub->fds[sub->is_output ? 0 : 1], sub->is_output ? 0 : 1);
+            if (spool_fd != -1) {
+                if (sub->is_output) {
+                    dup2(spool_fd, 1);
+                }
+                dup2(spool_fd, 2);
+            }
+
+            char *argv[64];
+            char *no_redirect[64];
+            char *stage_argv[64];
+            char *input_file[1] = {"stdin"};
+            char *output_file[1] = {"stdout"};
+            int is_append = 0;
+            int is_background = 0;
+            memset(no_redirect, 0, sizeof(no_redirect));
+            memset(stage_argv, 0, sizeof(stage_argv));
+            memcpy(argv, sub->tokens, sizeof(argv));
+            char *occurrence = strrchr(sub->tokens[0], '/');
+            argv[0] = occurrence != NULL ? occurrence + 1 : sub->tokens[0];
+            parse_redirects(argv, no_redirect, input_file, output_file,
+                            &is_append, &is_background, stage_argv);
+            if (stage_argv[0] != NULL || is_background) {
+                fprintf(stderr, "syntax error: a process substitution runs "
+                                "a single command \n");
+                cleanup_job_list(job_list);
+                exit(2);
+            }
+            redirect_file(input_file, output_file, is_append);
+            get_filepath(sub->tokens);
+            execv(sub->tokens[0], no_redirect);
+            perror("execv");
+            cleanup_job_list(job_list);
+            exit(127);
+        }
+        if (sub->pid == -1) {
+            perror("fork");
+        } else {
+            setpgid(sub->pid, pgid);
+        }
+    }
+    close_substitutions(subs, n);
+}
+
+/*
+ * Runs one parsed command line: handles leading variable assignments, the
+ * redirects, a timeout prefix and a tee stage, runs builtins in the shell
+ * and everything else in a child, and waits for foreground jobs
+ *
+ * Parameters:
+ *  - tokens: an array containing the parsed inputs, including the filepath
+ *  - argv: an array containing the parsed inputs without the full filepath
+ * (only file name)
+ *
+ * Returns:
+ *  - the exit status of the command, which is also stored in last_status
+ */
+int run_command(char *tokens[], char *argv[]) {
+    char *no_redirect[512];
+    char *input_file[50];
+    char *output_file[50];
+    char *stage_argv[512];
+    int is_append = 0;  // 0 for not, 1 for yes
+    int is_background_job = 0;
+    int status;
+
+    memset(&no_redirect[0], 0, 512 * sizeof(char *));
+    memset(&stage_argv[0], 0, 512 * sizeof(char *));
+    input_file[0] = "stdin";
+    output_file[0] = "stdout";
+    last_status = 0;
+
+    // the words as typed, for queueing the job (tokens is rearranged below)
+    char *words[512];
+    if (job_limit_active() && starting_jid == -1) {
+        memcpy(words, tokens, sizeof(words));
+    }
+
+    // leading NAME=value words set shell variables, or, when a command
+    // follows them, are added to that command's environment only
+    char *assignments[512];
+    int n_assignments = 0;
+    while (tokens[n_assignments] != NULL &&
+           find_assignment(tokens[n_assignments]) != NULL) {
+        assignments[n_assignments] = tokens[n_assignments];
+        n_assignments++;
+    }
+    assignments[n_assignments] = NULL;
+    if (n_assignments > 0 && tokens[n_assignments] == NULL) {
+        for (int i = 0; i < n_assignments; i++) {
+            char *equals = find_assignment(assignments[i]);
+            *equals = '\0';
+            set_var(assignments[i], equals + 1);
+            *equals = '=';
+        }
+        return last_status;
+    }
+    if (n_assignments > 0) {
+        int i = 0;
+        for (; tokens[i + n_assignments] != NULL; i++) {
+            tokens[i] = tokens[i + n_assignments];
+            argv[i] = tokens[i];
+        }
+        for (int j = i; j < i + n_assignments; j++) {
+            tokens[j] = NULL;
+            argv[j] = NULL;
+        }
+        char *occurrence = strrchr(tokens[0], '/');
+        argv[0] = occurrence != NULL ? occurrence + 1 : tokens[0];
+    }
+
+    // <(cmd) and >(cmd) become single words before the redirects are parsed,
+    // so the inner commands keep their own redirects
+    substitution_t subs[MAX_SUBSTITUTIONS];
+    int n_subs = find_substitutions(tokens, argv, subs);
+    if (n_subs == -1) {
+        last_status = 2;
+        return last_status;
+    }
+
+    uint64_t stage_start = TRACE_BEGIN();
+    parse_redirects(argv, no_redirect, input_file, output_file, &is_append,
+                    &is_background_job, stage_argv);
+    if (no_redirect[0] == NULL) {
+        return last_status;
+    }
+    get_filepath(tokens);  // making sure tokens[0] is the full filepath
+                           // name
+    long long timeout_ns = 0;
+    long long grace_ns = 0;
+    int timeout_sig = SIGTERM;
+    int has_timeout = strip_timeout(no_redirect, tokens, &timeout_ns,
+                                    &timeout_sig, &grace_ns);
+    TRACE_END(TRACE_PARSE_REDIRECTS, stage_start, tokens[0]);
+    if (has_timeout == -1) {
+        last_status = 1;
+        return last_status;
+    }
+
+    // like a timeout prefix, process substitution always runs a program
+    int sys_cmd = 0;
+    if (stage_argv[0] == NULL && has_timeout == 0 && n_subs == 0) {
+        stage_start = TRACE_BEGIN();
+        sys_cmd = check_sys_cmds(no_redirect, tokens, input_file,
+                                 output_file, is_append,
+                                 &is_background_job);
+        TRACE_END(TRACE_BUILTIN, stage_start, no_redirect[0]);
+    } else if (stage_argv[0] != NULL && strcmp(stage_argv[0], "tee") != 0) {
+        fprintf(stderr, "syntax error: only tee can follow | \n");
+        last_status = 1;
+        return last_status;
+    }
+
+    if (sys_cmd == 0 && is_background_job == 1 && starting_jid == -1 &&
+        job_limit_active()) {
+        // jobs beyond the limit wait, behind any that are already waiting
+        reaper();
+        start_queued_jobs();
+        if (next_queued_job(job_list) != -1 ||
+            !can_start_job(count_running_jobs(job_list))) {
+            char line[4096];
+            size_t len = 0;
+            line[0] = '\0';
+            for (int i = 0; words[i] != NULL && len < sizeof(line); i++) {
+                len += (size_t)snprintf(&line[len], sizeof(line) - len,
+                                        i == 0 ? "%s" : " %s", words[i]);
+            }
+            if (len < sizeof(line) &&
+                queue_job(job_list, job_number, tokens[0], line) == 0) {
+                fprintf(stdout, "[%d] queued\n", job_number);
+                job_number++;
+                return last_status;
+            }
+            // a line that does not fit is started right away
+        }
+    }
+
+    if (sys_cmd == 0) {
+        /* if cd, rm, or ln was not already called */
+
+        if (open_substitutions(subs, n_subs) == -1) {
+            last_status = 1;
+            return last_status;
+        }
+
+        // a tee stage reads the command's stdout through this pipe, which
+        // the substitutions' commands must not inherit
+        int stage_pipe[2] = {-1, -1};
+        if (stage_argv[0] != NULL && pipe2(stage_pipe, O_CLOEXEC) == -1) {
+            perror("pipe");
+            close_substitutions(subs, n_subs);
+            last_status = 1;
+            return last_status;
+        }
+
+        // with set -o spool a background job's output goes to a spool
+        // instead of the terminal
+        int spool_fd = -1;
+        spool_t *spool = NULL;
+        if (is_background_job == 1 && spool_enabled) {
+            spool = spool_open(&spool_fd);
+        }
+
+        pid_t pid = 0;
+
+        // without a terminal, and unless the child has to set up pipes or a
+        // spool first, the command is spawned rather than forked
+        int spawned = !interactive && stage_pipe[0] == -1 && n_subs == 0 &&
+                      spool_fd == -1;
+        stage_start = TRACE_BEGIN();
+        if (spawned) {
+            pid = spawn_command(tokens, no_redirect, input_file, output_file,
+                                is_append, assignments);
+            if (pid == -1) {
+                if (spool != NULL) {
+                    spool_free(spool);
+                }
+                return last_status;
+            }
+            if (is_background_job == 1) {
+                fprintf(stdout, "[%d] (%d) \n",
+                        starting_jid != -1 ? starting_jid : job_number, pid);
+            }
+        } else if ((pid = fork()) == 0) {
+            // making the the group process id unique
+            pid_t *pid_ptr = &pid;
+            *pid_ptr = getpid();
+            setpgid(pid, pid);
+
+
+            if (is_background_job == 0) {
+                // if it is not a background job, give it control of the
+                // terminal
+                give_terminal(pid);
+                reset_signals();
+                stage_start = TRACE_BEGIN();
+                redirect_file(input_file, output_file, is_append);
+                TRACE_END(TRACE_REDIRECT_FILE, stage_start, tokens[0]);
+
+            } else {
+                // if it is a background job, add it to the jobs list
+                give_terminal(parent_pgid);
+                reset_signals();
+                fprintf(stdout, "[%d] (%d) \n",
+                        starting_jid != -1 ? starting_jid : job_number, pid);
+                stage_start = TRACE_BEGIN();
+                redirect_file(input_file, output_file, is_append);
+                TRACE_END(TRACE_REDIRECT_FILE, stage_start, tokens[0]);
+            }
+
+            if (spool_fd != -1) {
+                if (strcmp(output_file[0], "stdout") == 0 &&
+                    stage_pipe[1] == -1) {
+                    dup2(spool_fd, 1);
+                }
+                dup2(spool_fd, 2);
+                close(spool_fd);
+            }
+            if (stage_pipe[1] != -1) {
+                // an explicit > redirect still wins over the pipe
+                if (strcmp(output_file[0], "stdout") == 0) {
+                    dup2(stage_pipe[1], 1);
+                }
+                close(stage_pipe[0]);
+                close(stage_pipe[1]);
+            }
+
+            // the job's ends of the substitutions' pipes stay open in the
+            // program as /dev/fd/N
+            for (int i = 0; i < n_subs; i++) {
+                fcntl(subs[i].fds[subs[i].is_output ? 1 : 0], F_SETFD, 0);
+            }
+
+            for (int i = 0; i < n_assignments; i++) {
+                putenv(assignments[i]);
+            }
+
+            if (trace_enabled) {
+                uint64_t exec_time = trace_now();
+                trace_record(TRACE_EXEC, exec_time, exec_time, tokens[0]);
+            }
+            execv(tokens[0], no_redirect);
+            perror("execv");
+            cleanup_job_list(job_list);
+            exit(127);  // the usual status for a command that cannot run
+        }
+        if (!spawned) {
+            TRACE_END(TRACE_FORK, stage_start, tokens[0]);
+            // the group must exist before anything joins, signals or
+            // samples it, whichever of the shell and the child gets there
+            // first (posix_spawn returns once the child is in it)
+            setpgid(pid, pid);
+        }
+        if (has_timeout && timeout_ns > 0) {
+            arm_timeout(pid, timeout_ns, timeout_sig, grace_ns,
+                        job_timed_out);
+        }
+
+        if (n_subs > 0) {
+            start_substitutions(subs, n_subs, pid, spool_fd);
+        }
+
+        pid_t stage_pid = -1;
+        if (stage_pipe[0] != -1) {
+            // the tee stage is a forked copy of the shell that joins the
+            // command's process group, so the job is stopped, continued
+            // and killed as a whole
+            if ((stage_pid = fork()) == 0) {
+                setpgid(0, pid);
+                reset_signals();
+                close(stage_pipe[1]);
+                if (spool_fd != -1) {
+                    dup2(spool_fd, 1);
+                    close(spool_fd);
+                }
+                int tee_status = run_tee(stage_argv, stage_pipe[0], 1);
+                cleanup_job_list(job_list);
+                exit(tee_status);
+            }
+            setpgid(stage_pid, pid);
+            close(stage_pipe[0]);
+            close(stage_pipe[1]);
+        }
+        if (spool_fd != -1) {
+            close(spool_fd);
+        }
+
+        if (is_background_job == 0) {
+            stage_start = TRACE_BEGIN();
+            int wait_err = wait_job(pid, &status);
+            int finished = wait_err != -1 && !WIFSTOPPED(status);
+            // the stage and each >(cmd) finish once the command's output is
+            // closed, and are waited for with the event loop still running.
+            // a <(cmd) may never finish if its output was not read to the
+            // end, so it is left to the reaper like those of a stopped job
+            int stage_status;
+            if (stage_pid != -1 &&
+                (!finished || wait_job(stage_pid, &stage_status) == -1 ||
+                 WIFSTOPPED(stage_status))) {
+                stray_children++;
+            }
+            for (int i = 0; i < n_subs; i++) {
+                if (subs[i].pid != -1 &&
+                    (!finished || !subs[i].is_output ||
+                     wait_job(subs[i].pid, &stage_status) == -1 ||
+                     WIFSTOPPED(stage_status))) {
+                    stray_children++;
+                }
+            }
+            TRACE_END(TRACE_WAIT, stage_start, tokens[0]);
+            if (wait_err == -1) {
+                perror("waitpid");
+                last_status = 1;
+            } else if (WIFSIGNALED(status)) {
+                // terminated by a signal
+                last_status = 128 + WTERMSIG(status);
+                fprintf(stdout, "[%d] (%d) %sterminated by signal %d\n",
+                        job_number, wait_err, timeout_note(pid),
+                        WTERMSIG(status));
+                remove_job_jid(job_list, job_number);
+            } else if (WIFSTOPPED(status)) {
+                // stopped
+                last_status = 128 + WSTOPSIG(status);
+                fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
+                        job_number, wait_err, WSTOPSIG(status));
+                add_job(job_list, job_number, pid, STOPPED, tokens[0]);
+                if (timeout_expired(pid)) {
+                    set_job_timed_out(job_list, pid);
+                }
+                job_number++;
+            } else if (timeout_expired(pid)) {
+                // exited on its own after being sent the signal
+                last_status = WEXITSTATUS(status);
+                fprintf(stdout,
+                        "[%d] (%d) timed out, terminated with exit status "
+                        "%d\n",
+                        job_number, wait_err, WEXITSTATUS(status));
+            } else {
+                last_status = WEXITSTATUS(status);
+            }
+            if (wait_err != -1 && !WIFSTOPPED(status)) {
+                disarm_timeout(pid);
+            }
+        } else if (is_background_job == 1) {
+            // its extra processes are reaped when they exit
+            stray_children += stage_pid != -1;
+            for (int i = 0; i < n_subs; i++) {
+                stray_children += subs[i].pid != -1;
+            }
+            // increase number of current background job
+            if (starting_jid != -1) {
+                start_queued_job(job_list, starting_jid, pid);
+            } else {
+                add_job(job_list, job_number, pid, RUNNING, tokens[0]);
+                job_number++;
+            }
+            if (spool != NULL) {
+                set_job_spool(job_list, pid, spool);
+            }
+            last_status = 0;
+        }
+
+        give_terminal(parent_pgid);
+    }
+
+    return last_status;
+}
+
+/*
+ * Starts a queued job now, whatever the job limit. In the background it
+ * keeps its job ID, in the foreground it leaves the job list and runs like a
+ * command typed without &.
+ *
+ * Parameters:
+ *  - jid: the job ID of the queued job
+ *  - foreground: 1 to run it in the foreground (fg), 0 for the background
+ *
+ * Returns:
+ *  - 0 on success, -1 if the job could not be started
+ */
+int start_queued_job_now(int jid, int foreground) {
+    const char *queued = get_queued_line(job_list, jid);
+    if (queued == NULL) {
+        return -1;
+    }
+    char *line = strdup(queued);
+    char *tokens[512];
+    char *argv[512];
+    memset(&tokens[0], 0, 512 * sizeof(char *));
+    memset(&argv[0], 0, 512 * sizeof(char *));
+    parse(line, tokens, argv);
+
+    if (foreground) {
+        remove_job_jid(job_list, jid);
+        // drop the trailing &
+        int last = 0;
+        while (tokens[last + 1] != NULL) {
+            last++;
+        }
+        if (last > 0 && strcmp(tokens[last], "&") == 0) {
+            tokens[last] = NULL;
+            argv[last] = NULL;
+        }
+        run_command(tokens, argv);
+        free(line);
+        return 0;
+    }
+
+    starting_jid = jid;
+    run_command(tokens, argv);
+    starting_jid = -1;
+    free(line);
+
+    if (get_job_state(job_list, jid) == QUEUED) {
+        // drop it rather than trying again forever, e.g. if fork failed
+        fprintf(stderr, "[%d] could not be started \n", jid);
+        remove_job_jid(job_list, jid);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Starts queued jobs, oldest first, while the job limit allows
+ *
+ * Returns:
+ *  - nothing
+ */
+void start_queued_jobs() {
+    int saved_status = last_status;
+    int jid;
+    while ((jid = next_queued_job(job_list)) != -1 &&
+           can_start_job(count_running_jobs(job_list))) {
+        start_queued_job_now(jid, 0);
+    }
+    last_status = saved_status;
+}
+
+/*
+ * Reaps the jobs that have exited and starts queued jobs in their place,
+ * called from the event loop while the shell waits for input
+ *
+ * Returns:
+ *  - nothing
+ */
+void reap_and_start() {
+    reaper();
+    start_queued_jobs();
+}
+
+/*
+ * Replaces $ references in the tokens with their values, splitting the
+ * results into words, and rebuilds argv to match
+ *
+ * Parameters:
+ *  - tokens: an array containing the parsed inputs, including the filepath
+ *  - argv: an array containing the parsed inputs without the full filepath
+ *
+ * Returns:
+ *  - 0 on success, -1 if an expansion failed, in which case last_status is
+ * set and the command must not run
+ */
+int expand_tokens(char *tokens[], char *argv[]) {
+    int n_tokens = 0;
+    int needs_expand = 0;
+    for (; tokens[n_tokens] != NULL; n_tokens++) {
+        if (strchr(tokens[n_tokens], '$') != NULL) {
+            needs_expand = 1;
+        }
+    }
+    if (!needs_expand) {
+        return 0;
+    }
+
+    char *expanded[512];
+    reset_expansions();
+    int n_expanded = expand_words(tokens, expanded, 511);
+    if (n_expanded < 0) {
+        last_status = n_expanded == -2 ? 2 : 1;
+        return -1;
+    }
+    for (int i = 0; i < n_expanded || i < n_tokens; i++) {
+        tokens[i] = i < n_expanded ? expanded[i] : NULL;
+        argv[i] = tokens[i];
+    }
+    if (tokens[0] != NULL) {
+        char *occurrence = strrchr(tokens[0], '/');
+        argv[0] = occurrence != NULL ? occurrence + 1 : tokens[0];
+    }
+    return 0;
+}
+
+/*
+ * Runs one simple command from a script, building argv from the already
+ * expanded tokens
+ *
+ * Parameters:
+ *  - tokens: the NULL-terminated words of the command
+ *
+ * Returns:
+ *  - the exit status of the command
+ */
+int run_words(char *tokens[]) {
+    char *words[512];
+    char *argv[512];
+    int i = 0;
+    for (; tokens[i] != NULL && i < 511; i++) {
+        words[i] = tokens[i];
+        argv[i] = tokens[i];
+    }
+    words[i] = NULL;
+    argv[i] = NULL;
+
+    char *occurrence = strrchr(words[0], '/');
+    argv[0] = occurrence != NULL ? occurrence + 1 : words[0];
+    return run_command(words, argv);
+}
+
+/*
+ * Waits until stdin is readable, running the event loop meanwhile if it has
+ * anything to do (time limits, spools, queued jobs to start as others exit)
+ *
+ * Returns:
+ *  - nothing
+ */
+void wait_for_input(void) {
+    int queued = next_queued_job(job_list) != -1;
+    if (event_count() > 0 || queued) {
+        if (queued) {
+            set_child_handler(reap_and_start);
+        }
+        wait_readable(0);
+        set_child_handler(NULL);
+    }
+}
+
+/*
+ * Reads one line of input. From a terminal the line is edited with the line
+ * editor, otherwise input is read in blocks, so when stdin is a pipe or a
+ * file the lines after this one are kept for the next calls.
+ *
+ * Parameters:
+ *  - line: where the line (including its newline) is stored
+ *  - size: the size of line
+ *  - prompt: the prompt printed before the line, for the line editor
+ *
+ * Returns:
+ *  - the length of the line, 0 at the end of input, -1 on failure, and size
+ * if the line did not fit (the rest of it is skipped)
+ */
+ssize_t read_line(char line[], size_t size, const char *prompt) {
+    static char input[4096];
+    static size_t input_len = 0;
+    static size_t input_pos = 0;
+    size_t len = 0;
+    int too_long = 0;
+
+    if (input_pos == input_len && interactive) {
+        return edit_line(prompt, line, size, wait_for_input);
+    }
+
+    while (1) {
+        while (input_pos < input_len) {
+            char c = input[input_pos++];
+            if (len < size - 1) {
+                line[len++] = c;
+            } else {
+                too_long = 1;
+            }
+            if (c == '\n') {
+                line[len] = '\0';
+                return too_long ? (ssize_t)size : (ssize_t)len;
+            }
+        }
+
+        wait_for_input();
+        ssize_t got = read(0, input, sizeof(input));
+        if (got <= 0) {
+            line[len] = '\0';
+            if (got == 0 && len > 0) {
+                return too_long ? (ssize_t)size : (ssize_t)len;
+            }
+            return got;
+        }
+        input_len = (size_t)got;
+        input_pos = 0;
+    }
+}
+
+/*
+ * Compiles and runs a line that uses ;, for, while, until or if, reading more
+ * lines while a construct is still open (e.g. before its done or fi)
+ *
+ * Parameters:
+ *  - line: the first line of the script
+ *
+ * Returns:
+ *  - nothing
+ */
+void run_script_text(char *line) {
+    size_t len = strlen(line);
+    char *text = (char *)malloc(len + 1);
+    memcpy(text, line, len + 1);
+
+    script_t *script = NULL;
+    int ret;
+    while ((ret = compile_script(text, &script)) == SCRIPT_INCOMPLETE) {
+#ifdef PROMPT
+        printf("%s", MORE_PROMPT_TEXT);
+        fflush(stdout);
+#endif
+        char more[1024];
+        ssize_t more_len = read_line(more, sizeof(more), MORE_PROMPT_TEXT);
+        if (more_len <= 0 || more_len >= 1024) {
+            fprintf(stderr, "syntax error: unexpected end of input \n");
+            free(text);
+            last_status = 1;
+            return;
+        }
+        char *grown = (char *)realloc(text, len + (size_t)more_len + 1);
+        if (grown == NULL) {
+            perror("realloc");
+            free(text);
+            return;
+        }
+        text = grown;
+        memcpy(&text[len], more, (size_t)more_len + 1);
+        len += (size_t)more_len;
+    }
+
+    if (ret == SCRIPT_OK) {
+        run_script(script, run_words);
+        free_script(script);
+    } else {
+        last_status = 2;
+    }
+    free(text);
+}
+
+int main() {
+    
+    char buffer[1024];
+    char *tokens[512];
+    char *argv[512];
+    job_list = init_job_list();
+    job_number = 1;
+    parent_pgid = getpid();
+    interactive = isatty(0);
+    ignore_signals();
+
+    set_builtin_names(builtin_names);
+
+    trace_file = getenv("SH33_TRACE");
+    if (trace_file != NULL && trace_start() == 0) {
+        atexit(dump_trace_at_exit);
+    }
+
+    while (1) { /*inifinite while loop*/
+        // without a terminal nothing is reaped until there is something to reap
+        if ((job_number > 1 && (interactive || has_jobs(job_list))) ||
+            stray_children > 0) {
+            uint64_t reap_start = TRACE_BEGIN();
+            reaper();
+            start_queued_jobs();
+            TRACE_END(TRACE_REAP, reap_start, NULL);
+        }
+#ifdef PROMPT
+        int err = printf("%s", PROMPT_TEXT);
+        if (err < 0) {
+            /* handle a write error */
+            fprintf(stderr, "Writing to terminal failed: %i\n", err);
+            return 1;
         }
         int err_two = fflush(stdout);
         if (err_two < 0) {
@@ -534,7 +2569,6 @@ int main() {
             return 1;
         }
 #endif
-        int status;
 
         /* we use memset to reset all the arrays to ensure that they are all
         cleared from previous
@@ -542,101 +2576,41 @@ int main() {
         memset(&argv[0], 0, 512 * sizeof(char *));
         memset(&buffer[0], 0, 1024 * sizeof(char));
         memset(&tokens[0], 0, 512 * sizeof(char *));
-        memset(&no_redirect[0], 0, 512 * sizeof(char *));
-        memset(&input_file[0], 0, 1 * sizeof(char *));
-        memset(&output_file[0], 0, 1 * sizeof(char *));
         memset(&fg_command[0], 0, 512 * sizeof(char *));
-        is_append = 0;  // 0 for not, 1 for yes
-        is_background_job = 0;
-        int *append_ptr = &is_append;
-        int *is_background_ptr = &is_background_job;
-        input_file[0] = "stdin";
-        output_file[0] = "stdout";
 
-        ssize_t buffer_size = read(0, buffer, 1024);
+        uint64_t stage_start = TRACE_BEGIN();
+        ssize_t buffer_size = read_line(buffer, 1024, PROMPT_TEXT);
+        TRACE_END(TRACE_READ, stage_start, NULL);
 
         if (buffer_size == -1) {
             fprintf(stderr, "Reading input failed \n");
         } else if (buffer_size == 1) {
             continue;
-        } else if (buffer_size > 1024) {
+        } else if (buffer_size >= 1024) {
             fprintf(stderr, "input is too long \n");
+            continue;
         } else if (buffer_size == 0) {
             /* in the case of ctrl-d */
             cleanup_job_list(job_list);
             exit(0);
         }
 
+        if (is_script(buffer)) {
+            run_script_text(buffer);
+            continue;
+        }
+
+        stage_start = TRACE_BEGIN();
         parse(buffer, tokens, argv);
+        int expand_err = expand_tokens(tokens, argv);
+        TRACE_END(TRACE_PARSE, stage_start, tokens[0]);
         fg_command[0] = tokens[0];
 
-        if (argv[0] == NULL) {
+        if (expand_err == -1 || argv[0] == NULL) {
             continue;
         }
 
-        parse_redirects(argv, no_redirect, input_file, output_file, append_ptr,
-                        is_background_ptr);
-        get_filepath(tokens);  // making sure tokens[0] is the full filepath
-                               // name
-        int sys_cmd = check_sys_cmds(argv, tokens, is_background_ptr);
-
-        if (sys_cmd == 0) {
-            /* if cd, rm, or ln was not already called */
-
-            pid_t pid = 0;
-
-            if ((pid = fork()) == 0) {
-                // making the the group process id unique
-                pid_t *pid_ptr = &pid;
-                *pid_ptr = getpid();
-                setpgid(pid, pid);
-
-                if (is_background_job == 0) {
-                    // if it is not a background job, give it control of the
-                    // terminal
-                    tcsetpgrp(0, pid);
-                    reset_signals();
-                    redirect_file(input_file, output_file, is_append);
-
-                } else {
-                    // if it is a background job, add it to the jobs list
-                    tcsetpgrp(0, parent_pgid);
-                    reset_signals();
-                    fprintf(stdout, "[%d] (%d) \n", job_number, pid);
-                    redirect_file(input_file, output_file, is_append);
-                }
-
-                execv(tokens[0], no_redirect);
-                perror("execv");
-                cleanup_job_list(job_list);
-                exit(0);
-            }
-
-            if (is_background_job == 0) {
-                int wait_err = waitpid(pid, &status, WUNTRACED);
-                if (wait_err == -1) {
-                    perror("waitpid");
-                } else if (WIFSIGNALED(status)) {
-                    // terminated by a signal
-                    fprintf(stdout, "[%d] (%d) terminated by signal %d\n",
-                            job_number, wait_err, WTERMSIG(status));
-                    remove_job_jid(job_list, job_number);
-                } else if (WIFSTOPPED(status)) {
-                    // stopped
-                    fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
-                            job_number, wait_err, WSTOPSIG(status));
-                    add_job(job_list, job_number, pid, STOPPED, tokens[0]);
-                    job_number++;
-                }
-            } else if (is_background_job == 1) {
-                // increase number of current background job
-                add_job(job_list, job_number, pid, RUNNING, tokens[0]);
-                job_number++;
-            }
-
-            tcsetpgrp(0, parent_pgid);
-            
-        }
+        run_command(tokens, argv);
     }
 
     cleanup_job_list(job_list);
@@ -0,0 +1,162 @@
+#include "./spool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "./events.h"
+
+struct spool {
+    int memfd;
+    char *data;  // the memfd mapped, SPOOL_SIZE bytes
+    unsigned long long written;  // total bytes ever drained into data
+    int read_fd;  // the shell's end of the job's pipe, -1 after the job
+                  // closed it
+    int attached_fd;  // also gets the output as it is drained, or -1
+};
+
+int spool_enabled = 0;
+
+/* stops watching the pipe once the job has closed it */
+static void spool_close_pipe(spool_t *spool) {
+    if (spool->read_fd != -1) {
+        remove_event(spool->read_fd);
+        close(spool->read_fd);
+        spool->read_fd = -1;
+    }
+}
+
+/* moves what the job wrote from its pipe into the ring, run by the event
+        loop whenever the pipe is readable */
+static void spool_drain(int fd, void *data) {
+    spool_t *spool = (spool_t *)data;
+
+    // read straight into the ring, up to its end; the loop calls again for
+    // the rest while the pipe stays readable
+    size_t pos = (size_t)(spool->written % SPOOL_SIZE);
+    ssize_t got = read(fd, &spool->data[pos], SPOOL_SIZE - pos);
+    if (got > 0) {
+        spool->written += (unsigned long long)got;
+        if (spool->attached_fd != -1 &&
+            write(spool->attached_fd, &spool->data[pos], (size_t)got) == -1) {
+            spool->attached_fd = -1;
+        }
+    } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+        spool_close_pipe(spool);
+    }
+}
+
+/*
+ * creates a spool and starts draining it, *write_fd is set to the end the
+ * job writes to, which the shell closes once the job is forked.
+ * returns NULL on failure
+ */
+spool_t *spool_open(int *write_fd) {
+    spool_t *spool = (spool_t *)malloc(sizeof(spool_t));
+    if (spool == NULL) {
+        perror("spool");
+        return NULL;
+    }
+    spool->written = 0;
+    spool->read_fd = -1;
+    spool->attached_fd = -1;
+    spool->data = MAP_FAILED;
+
+    // the memfd is sparse, pages are only used once output reaches them
+    spool->memfd = memfd_create("33sh-spool", MFD_CLOEXEC);
+    if (spool->memfd == -1 || ftruncate(spool->memfd, SPOOL_SIZE) == -1 ||
+        (spool->data = (char *)mmap(NULL, SPOOL_SIZE, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, spool->memfd, 0)) ==
+            MAP_FAILED) {
+        perror("spool");
+        spool_free(spool);
+        return NULL;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("spool");
+        spool_free(spool);
+        return NULL;
+    }
+    // only the shell's end is non-blocking, the job's end stays blocking
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    spool->read_fd = fds[0];
+    if (add_event(fds[0], spool_drain, spool) == -1) {
+        perror("spool");
+        close(fds[1]);
+        spool_free(spool);
+        return NULL;
+    }
+
+    *write_fd = fds[1];
+    return spool;
+}
+
+/* stops draining and frees the spool and its buffer */
+void spool_free(spool_t *spool) {
+    if (spool == NULL) {
+        return;
+    }
+    spool_close_pipe(spool);
+    if (spool->data != MAP_FAILED) {
+        munmap(spool->data, SPOOL_SIZE);
+    }
+    if (spool->memfd != -1) {
+        close(spool->memfd);
+    }
+    free(spool);
+}
+
+/* returns 1 while the job still has the spool's pipe open */
+int spool_is_open(spool_t *spool) { return spool->read_fd != -1; }
+
+/* also copies output to fd as it is drained (e.g. the terminal while the
+        job is in the foreground), -1 to stop */
+void spool_attach(spool_t *spool, int fd) { spool->attached_fd = fd; }
+
+/* drains what is already in the pipe without waiting for more */
+void spool_flush(spool_t *spool) {
+    unsigned long long before;
+    do {
+        before = spool->written;
+        if (spool->read_fd != -1) {
+            spool_drain(spool->read_fd, spool);
+        }
+    } while (spool->written != before);
+}
+
+/*
+ * writes the output after *offset (0 for all of it) to fd and advances
+ * *offset, returns the number of bytes that were overwritten before they
+ * could be written
+ */
+unsigned long long spool_print(spool_t *spool, unsigned long long *offset,
+                               int fd) {
+    unsigned long long dropped = 0;
+    if (spool->written - *offset > SPOOL_SIZE) {
+        dropped = spool->written - SPOOL_SIZE - *offset;
+        *offset = spool->written - SPOOL_SIZE;
+    }
+
+    while (*offset < spool->written) {
+        // at most up to the end of the ring in one write
+        size_t pos = (size_t)(*offset % SPOOL_SIZE);
+        size_t len = (size_t)(spool->written - *offset);
+        if (len > SPOOL_SIZE - pos) {
+            len = SPOOL_SIZE - pos;
+        }
+        ssize_t put = write(fd, &spool->data[pos], len);
+        if (put == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("joblog");
+            break;
+        }
+        *offset += (unsigned long long)put;
+    }
+    return dropped;
+}
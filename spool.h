@@ -0,0 +1,45 @@
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+/*
+ * opt-in spooling of background job output. A spooled job writes its stdout
+ * and stderr into a pipe that the shell drains through its event loop into
+ * a fixed-size ring buffer kept in a memfd, so the job neither writes over
+ * the prompt nor blocks on a slow terminal. Once the ring is full the oldest
+ * output is overwritten.
+ */
+
+#define SPOOL_SIZE (256 * 1024)
+
+typedef struct spool spool_t;
+
+/* 1 when new background jobs are spooled (set -o spool) */
+extern int spool_enabled;
+
+/*
+ * creates a spool and starts draining it, *write_fd is set to the end the
+ * job writes to, which the shell closes once the job is forked.
+ * returns NULL on failure
+ */
+spool_t *spool_open(int *write_fd);
+/* stops draining and frees the spool and its buffer */
+void spool_free(spool_t *spool);
+
+/* returns 1 while the job still has the spool's pipe open */
+int spool_is_open(spool_t *spool);
+
+/* also copies output to fd as it is drained (e.g. the terminal while the
+        job is in the foreground), -1 to stop */
+void spool_attach(spool_t *spool, int fd);
+/* drains what is already in the pipe without waiting for more */
+void spool_flush(spool_t *spool);
+
+/*
+ * writes the output after *offset (0 for all of it) to fd and advances
+ * *offset, returns the number of bytes that were overwritten before they
+ * could be written
+ */
+unsigned long long spool_print(spool_t *spool, unsigned long long *offset,
+                               int fd);
+
+#endif  // SPOOL_H_
@@ -0,0 +1,337 @@
+#include "./tee.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEE_CHUNK (64 * 1024)
+#define TEE_MAX_OUTS 64
+
+struct tee_sink {
+    int fd;
+    int splice_ok;  // cleared once splice(2) refuses the descriptor
+    int dead;       // set once a write to the descriptor has failed
+};
+typedef struct tee_sink tee_sink_t;
+
+/* writes all len bytes of buf to fd, returns 0 on success, -1 on failure */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+/* reads and throws away len bytes from fd */
+static void discard(int fd, size_t len, char *buf) {
+    while (len > 0) {
+        ssize_t got = read(fd, buf, len < TEE_CHUNK ? len : TEE_CHUNK);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return;
+        }
+        len -= (size_t)got;
+    }
+}
+
+/*
+ * moves len bytes that are already sitting in the pipe in_fd to the sink,
+ * with splice(2) while the sink accepts it and read/write otherwise
+ * returns the number of bytes taken out of in_fd, len on success and less
+ * if writing to the sink failed
+ */
+static size_t drain_to_sink(int in_fd, tee_sink_t *sink, size_t len,
+                            char *buf) {
+    size_t taken = 0;
+    while (taken < len) {
+        if (sink->splice_ok) {
+            ssize_t moved = splice(in_fd, NULL, sink->fd, NULL, len - taken,
+                                   SPLICE_F_MOVE);
+            if (moved > 0) {
+                taken += (size_t)moved;
+            } else if (moved == -1 && errno == EINVAL) {
+                // terminals and O_APPEND files cannot be spliced to
+                sink->splice_ok = 0;
+            } else if (moved == -1 && errno != EINTR) {
+                return taken;
+            }
+            continue;
+        }
+
+        size_t want = len - taken < TEE_CHUNK ? len - taken : TEE_CHUNK;
+        ssize_t got = read(in_fd, buf, want);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return taken;
+        }
+        // the bytes read are gone from in_fd even if the write fails
+        taken += (size_t)got;
+        if (write_all(sink->fd, buf, (size_t)got) == -1) {
+            return taken;
+        }
+    }
+    return taken;
+}
+
+/*
+ * buffered fallback, used when the input is not a pipe
+ * returns 0 on success, -1 if any output failed
+ */
+static int tee_copy(int in_fd, tee_sink_t sinks[], int n_outs, char *buf) {
+    int status = 0;
+    while (1) {
+        ssize_t got = read(in_fd, buf, TEE_CHUNK);
+        if (got == 0) {
+            return status;
+        } else if (got == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("tee: read");
+            return -1;
+        }
+
+        int live = 0;
+        for (int i = 0; i < n_outs; i++) {
+            if (sinks[i].dead) {
+                continue;
+            }
+            if (write_all(sinks[i].fd, buf, (size_t)got) == -1) {
+                perror("tee: write");
+                sinks[i].dead = 1;
+                status = -1;
+            } else {
+                live++;
+            }
+        }
+        if (live == 0) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * zero-copy path for pipe input. Each round, every output but the last gets
+ * its own tee(2) of the head of in_fd into an empty scratch pipe, which is
+ * then spliced out to that output; the last output consumes the same bytes
+ * straight from in_fd. The scratch pipe is sized like in_fd so that a tee
+ * into it is never short.
+ * returns 0 on success, -1 if any output failed
+ */
+static int tee_pipe(int in_fd, tee_sink_t sinks[], int n_outs, char *buf) {
+    int scratch[2] = {-1, -1};
+    int status = 0;
+
+    if (n_outs > 1) {
+        if (pipe(scratch) == -1) {
+            return tee_copy(in_fd, sinks, n_outs, buf);
+        }
+        int in_size = fcntl(in_fd, F_GETPIPE_SZ);
+        if (in_size > 0) {
+            fcntl(scratch[1], F_SETPIPE_SZ, in_size);
+        }
+    }
+
+    while (1) {
+        int last = -1;
+        for (int i = 0; i < n_outs; i++) {
+            if (!sinks[i].dead) {
+                last = i;
+            }
+        }
+        if (last == -1) {
+            status = -1;
+            break;
+        }
+
+        ssize_t round = -1;  // bytes in this round, known after the first tee
+        for (int i = 0; i < last; i++) {
+            if (sinks[i].dead) {
+                continue;
+            }
+            ssize_t copied =
+                tee(in_fd, scratch[1], round == -1 ? TEE_CHUNK : (size_t)round,
+                    0);
+            if (copied == -1 && errno == EINTR && round == -1) {
+                i--;
+                continue;
+            }
+            if (copied == -1 && round == -1) {
+                // nothing consumed yet, finish with the buffered copy
+                int copy_status = tee_copy(in_fd, sinks, n_outs, buf);
+                close(scratch[0]);
+                close(scratch[1]);
+                return copy_status == -1 ? -1 : status;
+            }
+            if (copied == 0) {
+                goto done;  // end of input
+            }
+            if (round == -1) {
+                round = copied;
+            } else if (copied != round) {
+                fprintf(stderr, "tee: short duplicate\n");
+                discard(scratch[0], copied > 0 ? (size_t)copied : 0, buf);
+                sinks[i].dead = 1;
+                status = -1;
+                continue;
+            }
+            size_t drained =
+                drain_to_sink(scratch[0], &sinks[i], (size_t)copied, buf);
+            if (drained < (size_t)copied) {
+                perror("tee: write");
+                discard(scratch[0], (size_t)copied - drained, buf);
+                sinks[i].dead = 1;
+                status = -1;
+            }
+        }
+
+        if (round == -1) {
+            // only one output left, move the input to it directly
+            if (sinks[last].splice_ok) {
+                ssize_t moved = splice(in_fd, NULL, sinks[last].fd, NULL,
+                                       TEE_CHUNK, SPLICE_F_MOVE);
+                if (moved == 0) {
+                    break;
+                } else if (moved > 0 || errno == EINTR) {
+                    continue;
+                } else if (errno == EINVAL) {
+                    sinks[last].splice_ok = 0;
+                    continue;
+                }
+                perror("tee: write");
+                sinks[last].dead = 1;
+                status = -1;
+                continue;
+            }
+            ssize_t got = read(in_fd, buf, TEE_CHUNK);
+            if (got == 0) {
+                break;
+            } else if (got == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("tee: read");
+                status = -1;
+                break;
+            }
+            if (write_all(sinks[last].fd, buf, (size_t)got) == -1) {
+                perror("tee: write");
+                sinks[last].dead = 1;
+                status = -1;
+            }
+            continue;
+        }
+
+        // the rest of the round has already gone to the other outputs, so
+        // only that much is dropped if this one fails
+        size_t drained = drain_to_sink(in_fd, &sinks[last], (size_t)round, buf);
+        if (drained < (size_t)round) {
+            perror("tee: write");
+            discard(in_fd, (size_t)round - drained, buf);
+            sinks[last].dead = 1;
+            status = -1;
+        }
+    }
+
+done:
+    if (scratch[0] != -1) {
+        close(scratch[0]);
+        close(scratch[1]);
+    }
+    return status;
+}
+
+/*
+ * copies everything read from in_fd to each of the n_outs descriptors in
+ * out_fds until end of file. When in_fd is a pipe the data is duplicated
+ * in the kernel with tee(2) and moved with splice(2); any other input, and
+ * any output that cannot be spliced to (a terminal, an O_APPEND file), is
+ * handled with a buffered read/write copy.
+ * returns 0 on success, -1 on failure
+ */
+int tee_fds(int in_fd, int out_fds[], int n_outs) {
+    if (n_outs < 1 || n_outs > TEE_MAX_OUTS) {
+        fprintf(stderr, "tee: too many outputs\n");
+        return -1;
+    }
+
+    tee_sink_t sinks[TEE_MAX_OUTS];
+    for (int i = 0; i < n_outs; i++) {
+        sinks[i].fd = out_fds[i];
+        sinks[i].splice_ok = 1;
+        sinks[i].dead = 0;
+    }
+
+    char *buf = (char *)malloc(TEE_CHUNK);
+    if (buf == NULL) {
+        perror("tee");
+        return -1;
+    }
+
+    int status;
+    struct stat in_stat;
+    if (fstat(in_fd, &in_stat) == 0 && S_ISFIFO(in_stat.st_mode)) {
+        status = tee_pipe(in_fd, sinks, n_outs, buf);
+    } else {
+        status = tee_copy(in_fd, sinks, n_outs, buf);
+    }
+
+    free(buf);
+    return status;
+}
+
+/*
+ * tee command, argv is { "tee", ["-a",] file..., NULL }
+ * copies in_fd to out_fd and to every named file, truncating the files
+ * unless -a is given. returns 0 on success, 1 on failure
+ */
+int run_tee(char *argv[], int in_fd, int out_fd) {
+    int flags = O_CREAT | O_TRUNC | O_WRONLY;
+    int status = 0;
+    int i = 1;
+    if (argv[1] && strcmp(argv[1], "-a") == 0) {
+        flags = O_CREAT | O_APPEND | O_WRONLY;
+        i++;
+    }
+
+    int fds[TEE_MAX_OUTS];
+    int n_outs = 0;
+    fds[n_outs++] = out_fd;
+    for (; argv[i]; i++) {
+        if (n_outs == TEE_MAX_OUTS) {
+            fprintf(stderr, "tee: too many files \n");
+            status = 1;
+            break;
+        }
+        int fd = open(argv[i], flags, S_IRWXU);
+        if (fd == -1) {
+            perror("tee");
+            status = 1;
+            continue;
+        }
+        fds[n_outs++] = fd;
+    }
+
+    if (tee_fds(in_fd, fds, n_outs) == -1) {
+        status = 1;
+    }
+    for (int j = 1; j < n_outs; j++) {
+        close(fds[j]);
+    }
+    return status;
+}
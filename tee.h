@@ -0,0 +1,21 @@
+#ifndef TEE_H_
+#define TEE_H_
+
+/*
+ * copies everything read from in_fd to each of the n_outs descriptors in
+ * out_fds until end of file. When in_fd is a pipe the data is duplicated
+ * in the kernel with tee(2) and moved with splice(2); any other input, and
+ * any output that cannot be spliced to (a terminal, an O_APPEND file), is
+ * handled with a buffered read/write copy.
+ * returns 0 on success, -1 on failure
+ */
+int tee_fds(int in_fd, int out_fds[], int n_outs);
+
+/*
+ * tee command, argv is { "tee", ["-a",] file..., NULL }
+ * copies in_fd to out_fd and to every named file, truncating the files
+ * unless -a is given. returns 0 on success, 1 on failure
+ */
+int run_tee(char *argv[], int in_fd, int out_fd);
+
+#endif  // TEE_H_
@@ -0,0 +1,314 @@
+#include "./test.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STAT_CACHE 8
+
+// the result of looking up one path
+struct stat_entry {
+    const char *path;
+    int follow;  // 0 for the link itself (-h, -L)
+    int err;     // 0, or the errno of the failed lookup
+    struct stat st;
+};
+typedef struct stat_entry stat_entry_t;
+
+struct test {
+    char **args;
+    int n_args;
+    int pos;
+    int failed;
+    stat_entry_t cache[STAT_CACHE];
+    int n_cached;
+    int last_stat;  // the entry test_stat returned last, -1 for none
+};
+typedef struct test test_t;
+
+static int parse_or(test_t *t);
+
+/* prints an error about the expression, once */
+static void test_error(test_t *t, const char *what, const char *msg) {
+    if (!t->failed) {
+        if (what != NULL) {
+            fprintf(stderr, "test: %s: %s \n", what, msg);
+        } else {
+            fprintf(stderr, "test: %s \n", msg);
+        }
+        t->failed = 1;
+    }
+}
+
+/*
+ * looks up path with fstatat, reusing the result if the command already
+ * looked it up, returns its entry (err is set if the lookup failed)
+ */
+static stat_entry_t *test_stat(test_t *t, const char *path, int follow) {
+    for (int i = 0; i < t->n_cached; i++) {
+        if (t->cache[i].follow == follow &&
+            strcmp(t->cache[i].path, path) == 0) {
+            t->last_stat = i;
+            return &t->cache[i];
+        }
+    }
+
+    // a full cache reuses one of its last two slots, never the one just
+    // returned, which may hold the other operand of -nt, -ot or -ef
+    int slot = t->n_cached;
+    if (t->n_cached < STAT_CACHE) {
+        t->n_cached++;
+    } else {
+        slot = t->last_stat == STAT_CACHE - 1 ? STAT_CACHE - 2
+                                              : STAT_CACHE - 1;
+    }
+    t->last_stat = slot;
+    stat_entry_t *entry = &t->cache[slot];
+    entry->path = path;
+    entry->follow = follow;
+    entry->err = 0;
+    if (fstatat(AT_FDCWD, path, &entry->st,
+                follow ? 0 : AT_SYMLINK_NOFOLLOW) == -1) {
+        entry->err = errno;
+    }
+    return entry;
+}
+
+/* parses an integer operand, leading and trailing blanks are allowed */
+static long long test_integer(test_t *t, const char *arg) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        test_error(t, arg, "integer expression expected");
+        return 0;
+    }
+    return value;
+}
+
+/* returns 1 if op is a binary operator */
+static int is_binary(const char *op) {
+    static const char *ops[] = {"=",   "==",  "!=",  "-eq", "-ne",
+                                "-lt", "-le", "-gt", "-ge", "-nt",
+                                "-ot", "-ef"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(op, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* returns 1 if op is a unary operator */
+static int is_unary(const char *op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+           strchr("bcdefghLkprsStuwxnz", op[1]) != NULL;
+}
+
+/* evaluates left op right */
+static int binary(test_t *t, const char *left, const char *op,
+                  const char *right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(left, right) == 0;
+    } else if (strcmp(op, "!=") == 0) {
+        return strcmp(left, right) != 0;
+    } else if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0) {
+        // a file that exists is newer than one that does not
+        stat_entry_t *a = test_stat(t, left, 1);
+        stat_entry_t *b = test_stat(t, right, 1);
+        if (op[1] == 'o') {
+            stat_entry_t *swap = a;
+            a = b;
+            b = swap;
+        }
+        if (a->err != 0) {
+            return 0;
+        }
+        if (b->err != 0) {
+            return 1;
+        }
+        return a->st.st_mtim.tv_sec > b->st.st_mtim.tv_sec ||
+               (a->st.st_mtim.tv_sec == b->st.st_mtim.tv_sec &&
+                a->st.st_mtim.tv_nsec > b->st.st_mtim.tv_nsec);
+    } else if (strcmp(op, "-ef") == 0) {
+        stat_entry_t *a = test_stat(t, left, 1);
+        stat_entry_t *b = test_stat(t, right, 1);
+        return a->err == 0 && b->err == 0 && a->st.st_dev == b->st.st_dev &&
+               a->st.st_ino == b->st.st_ino;
+    }
+
+    long long x = test_integer(t, left);
+    long long y = test_integer(t, right);
+    if (strcmp(op, "-eq") == 0) {
+        return x == y;
+    } else if (strcmp(op, "-ne") == 0) {
+        return x != y;
+    } else if (strcmp(op, "-lt") == 0) {
+        return x < y;
+    } else if (strcmp(op, "-le") == 0) {
+        return x <= y;
+    } else if (strcmp(op, "-gt") == 0) {
+        return x > y;
+    }
+    return x >= y;
+}
+
+/* evaluates -op arg */
+static int unary(test_t *t, char op, const char *arg) {
+    switch (op) {
+        case 'n':
+            return arg[0] != '\0';
+        case 'z':
+            return arg[0] == '\0';
+        case 't':
+            return isatty((int)test_integer(t, arg));
+        case 'r':
+            return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+        case 'w':
+            return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+        case 'x':
+            return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+    }
+
+    stat_entry_t *entry = test_stat(t, arg, op != 'h' && op != 'L');
+    if (entry->err != 0) {
+        return 0;
+    }
+    mode_t mode = entry->st.st_mode;
+    switch (op) {
+        case 'e':
+            return 1;
+        case 'f':
+            return S_ISREG(mode);
+        case 'd':
+            return S_ISDIR(mode);
+        case 'h':
+        case 'L':
+            return S_ISLNK(mode);
+        case 'p':
+            return S_ISFIFO(mode);
+        case 'S':
+            return S_ISSOCK(mode);
+        case 'b':
+            return S_ISBLK(mode);
+        case 'c':
+            return S_ISCHR(mode);
+        case 's':
+            return entry->st.st_size > 0;
+        case 'u':
+            return (mode & S_ISUID) != 0;
+        case 'g':
+            return (mode & S_ISGID) != 0;
+        case 'k':
+            return (mode & S_ISVTX) != 0;
+    }
+    return 0;
+}
+
+static int parse_primary(test_t *t) {
+    int left = t->n_args - t->pos;
+    if (left <= 0) {
+        test_error(t, NULL, "argument expected");
+        return 0;
+    }
+    char **args = &t->args[t->pos];
+
+    if (left >= 3 && is_binary(args[1])) {
+        t->pos += 3;
+        return binary(t, args[0], args[1], args[2]);
+    }
+    if (strcmp(args[0], "(") == 0 && left >= 2) {
+        t->pos++;
+        int value = parse_or(t);
+        if (t->pos >= t->n_args || strcmp(t->args[t->pos], ")") != 0) {
+            test_error(t, NULL, "missing )");
+            return 0;
+        }
+        t->pos++;
+        return value;
+    }
+    if (left >= 2 && is_unary(args[0])) {
+        t->pos += 2;
+        return unary(t, args[0][1], args[1]);
+    }
+
+    // a lone word is true if it is not empty
+    t->pos++;
+    return args[0][0] != '\0';
+}
+
+static int parse_not(test_t *t) {
+    int left = t->n_args - t->pos;
+    // ! = x compares "!" with x
+    if (left >= 2 && strcmp(t->args[t->pos], "!") == 0 &&
+        !(left == 3 && is_binary(t->args[t->pos + 1]))) {
+        t->pos++;
+        return !parse_not(t);
+    }
+    return parse_primary(t);
+}
+
+static int parse_and(test_t *t) {
+    int value = parse_not(t);
+    while (t->pos < t->n_args && strcmp(t->args[t->pos], "-a") == 0) {
+        t->pos++;
+        int right = parse_not(t);
+        value = value && right;
+    }
+    return value;
+}
+
+static int parse_or(test_t *t) {
+    int value = parse_and(t);
+    while (t->pos < t->n_args && strcmp(t->args[t->pos], "-o") == 0) {
+        t->pos++;
+        int right = parse_and(t);
+        value = value || right;
+    }
+    return value;
+}
+
+/*
+ * evaluates argv, which starts with "test" or "[" (then it must end with
+ * "]"), returns 0 if the expression is true, 1 if it is false and 2 after
+ * printing an error
+ */
+int run_test(char *argv[]) {
+    test_t t;
+    t.args = &argv[1];
+    t.n_args = 0;
+    t.pos = 0;
+    t.failed = 0;
+    t.n_cached = 0;
+    t.last_stat = -1;
+    while (t.args[t.n_args] != NULL) {
+        t.n_args++;
+    }
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (t.n_args == 0 || strcmp(t.args[t.n_args - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ] \n");
+            return 2;
+        }
+        t.n_args--;
+    }
+    if (t.n_args == 0) {
+        // no expression is false
+        return 1;
+    }
+
+    int value = parse_or(&t);
+    if (!t.failed && t.pos < t.n_args) {
+        test_error(&t, t.args[t.pos], "unexpected argument");
+    }
+    if (t.failed) {
+        return 2;
+    }
+    return value ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+/*
+ * the test and [ builtins: file checks (-e -f -d -h -L -p -S -b -c -s -r -w
+ * -x -u -g -k -t, -nt -ot -ef), string checks (-n -z = == !=) and integer
+ * comparisons (-eq -ne -lt -le -gt -ge), combined with ! -a -o and
+ * parentheses. Files are looked up with fstatat and each path is only looked
+ * up once per command.
+ */
+
+/*
+ * evaluates argv, which starts with "test" or "[" (then it must end with
+ * "]"), returns 0 if the expression is true, 1 if it is false and 2 after
+ * printing an error
+ */
+int run_test(char *argv[]);
+
+#endif  // TEST_H_
@@ -0,0 +1,195 @@
+#include "./timeout.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "./events.h"
+
+struct job_timer {
+    int fd;
+    pid_t pgid;
+    int sig;
+    long long grace_ns;
+    int expired;  // 1 once sig has been sent
+    void (*on_expire)(pid_t pgid);
+};
+typedef struct job_timer job_timer_t;
+
+// open addressing table keyed by pgid, cap is a power of two and at most
+// half full, so arming, disarming and looking up a timer do not depend on
+// how many jobs have one
+static job_timer_t **timers = NULL;
+static size_t n_timers = 0;
+static size_t timers_cap = 0;
+
+/* sets a one-shot expiry ns nanoseconds from now, returns 0 or -1 */
+static int set_timer(int fd, long long ns) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(ns / 1000000000LL);
+    spec.it_value.tv_nsec = (long)(ns % 1000000000LL);
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+/* event handler for an expired timerfd */
+static void timer_fired(int fd, void *data) {
+    job_timer_t *timer = (job_timer_t *)data;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == -1) {
+        return;
+    }
+
+    if (timer->expired) {
+        // the grace period is over as well
+        kill(-timer->pgid, SIGKILL);
+        return;
+    }
+
+    timer->expired = 1;
+    kill(-timer->pgid, timer->sig);
+    if (timer->sig != SIGKILL && timer->sig != SIGCONT) {
+        kill(-timer->pgid, SIGCONT);
+    }
+    if (timer->on_expire != NULL) {
+        timer->on_expire(timer->pgid);
+    }
+    if (timer->grace_ns > 0) {
+        set_timer(fd, timer->grace_ns);
+    }
+}
+
+/* returns the slot of pgid in table, either its timer or an empty one */
+static size_t find_slot(job_timer_t **table, size_t cap, pid_t pgid) {
+    size_t i = ((size_t)pgid * 2654435761U) & (cap - 1);
+    while (table[i] != NULL && table[i]->pgid != pgid) {
+        i = (i + 1) & (cap - 1);
+    }
+    return i;
+}
+
+/* returns pgid's timer, NULL if it has none */
+static job_timer_t *find_timer(pid_t pgid) {
+    if (timers_cap == 0) {
+        return NULL;
+    }
+    return timers[find_slot(timers, timers_cap, pgid)];
+}
+
+/* moves the timers into a table of new_cap slots,
+        returns 0 on success, -1 on failure */
+static int grow_timers(size_t new_cap) {
+    job_timer_t **table =
+        (job_timer_t **)calloc(new_cap, sizeof(job_timer_t *));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < timers_cap; i++) {
+        if (timers[i] != NULL) {
+            table[find_slot(table, new_cap, timers[i]->pgid)] = timers[i];
+        }
+    }
+    free(timers);
+    timers = table;
+    timers_cap = new_cap;
+    return 0;
+}
+
+/*
+ * arms a time limit of duration_ns nanoseconds for the process group pgid.
+ * expired, if not NULL, is called with pgid when the limit is reached.
+ * returns 0 on success, -1 on failure
+ */
+int arm_timeout(pid_t pgid, long long duration_ns, int sig, long long grace_ns,
+                void (*expired)(pid_t pgid)) {
+    if ((n_timers + 1) * 2 > timers_cap &&
+        grow_timers(timers_cap ? timers_cap * 2 : 16) == -1) {
+        perror("timeout");
+        return -1;
+    }
+    // each group has one timer, a PID reused by a new job replaces the
+    // timer its old job left behind
+    disarm_timeout(pgid);
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1 && errno == EMFILE) {
+        // every timer is a descriptor, so allow as many as the hard limit
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+            limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        }
+    }
+    if (fd == -1) {
+        perror("timeout: timerfd_create");
+        return -1;
+    }
+
+    job_timer_t *timer = (job_timer_t *)malloc(sizeof(job_timer_t));
+    if (timer == NULL) {
+        perror("malloc");
+        close(fd);
+        return -1;
+    }
+    timer->fd = fd;
+    timer->pgid = pgid;
+    timer->sig = sig;
+    timer->grace_ns = grace_ns;
+    timer->expired = 0;
+    timer->on_expire = expired;
+
+    if (set_timer(fd, duration_ns) == -1 ||
+        add_event(fd, timer_fired, timer) == -1) {
+        perror("timeout");
+        close(fd);
+        free(timer);
+        return -1;
+    }
+
+    timers[find_slot(timers, timers_cap, pgid)] = timer;
+    n_timers++;
+    return 0;
+}
+
+/* cancels the time limit of pgid, if there is one */
+void disarm_timeout(pid_t pgid) {
+    if (timers_cap == 0) {
+        return;
+    }
+    size_t hole = find_slot(timers, timers_cap, pgid);
+    job_timer_t *timer = timers[hole];
+    if (timer == NULL) {
+        return;
+    }
+    remove_event(timer->fd);
+    close(timer->fd);
+    free(timer);
+    timers[hole] = NULL;
+    n_timers--;
+
+    // the timers after it that were placed past its slot move back, so
+    // lookups never stop at the hole it leaves
+    size_t mask = timers_cap - 1;
+    for (size_t i = (hole + 1) & mask; timers[i] != NULL;
+         i = (i + 1) & mask) {
+        size_t home = ((size_t)timers[i]->pgid * 2654435761U) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            timers[hole] = timers[i];
+            timers[i] = NULL;
+            hole = i;
+        }
+    }
+}
+
+/* returns 1 if pgid had a time limit that has expired, 0 otherwise */
+int timeout_expired(pid_t pgid) {
+    job_timer_t *timer = find_timer(pgid);
+    return timer != NULL && timer->expired;
+}
@@ -0,0 +1,26 @@
+#ifndef TIMEOUT_H_
+#define TIMEOUT_H_
+
+#include <sys/types.h>
+
+/*
+ * per-job time limits. Each limit is one timerfd in the shell's event loop;
+ * when it expires the job's process group gets sig (followed by SIGCONT so a
+ * stopped job sees it) and, if grace_ns is not 0, SIGKILL grace_ns later.
+ */
+
+/*
+ * arms a time limit of duration_ns nanoseconds for the process group pgid.
+ * expired, if not NULL, is called with pgid when the limit is reached.
+ * returns 0 on success, -1 on failure
+ */
+int arm_timeout(pid_t pgid, long long duration_ns, int sig, long long grace_ns,
+                void (*expired)(pid_t pgid));
+
+/* cancels the time limit of pgid, if there is one */
+void disarm_timeout(pid_t pgid);
+
+/* returns 1 if pgid had a time limit that has expired, 0 otherwise */
+int timeout_expired(pid_t pgid);
+
+#endif  // TIMEOUT_H_
@@ -0,0 +1,166 @@
+#include "./trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_CAPACITY (1 << 16)
+#define TRACE_LABEL_LEN 32
+
+struct trace_event {
+    uint64_t seq;  // index + 1 once the event is completely written
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int32_t pid;
+    int32_t stage;
+    char label[TRACE_LABEL_LEN];
+};
+typedef struct trace_event trace_event_t;
+
+// head counts every event ever recorded, the slot is head % TRACE_CAPACITY
+struct trace_ring {
+    uint64_t head;
+    trace_event_t events[TRACE_CAPACITY];
+};
+typedef struct trace_ring trace_ring_t;
+
+// indexed by trace_stage_t
+static const char *stage_names[] = {
+    "read",          "parse", "parse_redirects", "builtin", "fork",
+    "redirect_file", "execv", "wait",            "reap",
+};
+
+int trace_enabled = 0;
+static trace_ring_t *ring = NULL;
+static pid_t shell_pid = 0;
+
+/* turns tracing on, allocating the ring buffer the first time,
+        returns 0 on success, -1 on failure */
+int trace_start(void) {
+    if (ring == NULL) {
+        // shared, so events recorded by forked children are seen here
+        void *mem = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            perror("trace: mmap");
+            return -1;
+        }
+        ring = (trace_ring_t *)mem;
+        shell_pid = getpid();
+    }
+    trace_enabled = 1;
+    return 0;
+}
+
+/* turns tracing off, the recorded events are kept */
+void trace_stop(void) { trace_enabled = 0; }
+
+/* returns the current CLOCK_MONOTONIC time in nanoseconds */
+uint64_t trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * records that stage ran from start_ns to end_ns in the calling process,
+ * label (may be NULL) is usually the command being run.
+ * end_ns == start_ns records an instant, e.g. the call to execv
+ */
+void trace_record(trace_stage_t stage, uint64_t start_ns, uint64_t end_ns,
+                  const char *label) {
+    if (ring == NULL || start_ns == 0) {
+        // start_ns is 0 if tracing was turned on part way through the stage
+        return;
+    }
+
+    uint64_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    trace_event_t *event = &ring->events[index % TRACE_CAPACITY];
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->pid = (int32_t)getpid();
+    event->stage = (int32_t)stage;
+    if (label != NULL) {
+        strncpy(event->label, label, TRACE_LABEL_LEN - 1);
+        event->label[TRACE_LABEL_LEN - 1] = '\0';
+    } else {
+        event->label[0] = '\0';
+    }
+    __atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+/* writes str as the contents of a JSON string */
+static void write_json_string(FILE *out, const char *str) {
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(out, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char)*str);
+        } else {
+            fputc(*str, out);
+        }
+    }
+}
+
+/* writes the recorded events to path as Chrome trace JSON ("-" for stdout),
+        returns 0 on success, -1 on failure */
+int trace_dump(const char *path) {
+    if (ring == NULL) {
+        fprintf(stderr, "trace: nothing recorded \n");
+        return -1;
+    }
+
+    FILE *out = stdout;
+    if (strcmp(path, "-") != 0) {
+        out = fopen(path, "w");
+        if (out == NULL) {
+            perror("trace");
+            return -1;
+        }
+    }
+
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+    int written = 0;
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (uint64_t index = first; index < head; index++) {
+        trace_event_t *event = &ring->events[index % TRACE_CAPACITY];
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != index + 1) {
+            continue;  // overwritten, or still being written by a child
+        }
+
+        // Chrome traces are in microseconds, keep the nanoseconds as decimals
+        fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"repl\",",
+                written ? ",\n" : "", stage_names[event->stage]);
+        if (event->end_ns > event->start_ns) {
+            uint64_t dur = event->end_ns - event->start_ns;
+            fprintf(out, "\"ph\":\"X\",\"dur\":%llu.%03llu,",
+                    (unsigned long long)(dur / 1000),
+                    (unsigned long long)(dur % 1000));
+        } else {
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",");
+        }
+        fprintf(out,
+                "\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"cmd\":\"",
+                (unsigned long long)(event->start_ns / 1000),
+                (unsigned long long)(event->start_ns % 1000), (int)shell_pid,
+                (int)event->pid);
+        write_json_string(out, event->label);
+        fprintf(out, "\"}}");
+        written++;
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    if (out != stdout) {
+        if (fclose(out) == EOF) {
+            perror("trace");
+            return -1;
+        }
+    } else {
+        fflush(out);
+    }
+    return 0;
+}
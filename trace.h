@@ -0,0 +1,60 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * opt-in tracing of the stages of the shell's read/execute loop. Events are
+ * CLOCK_MONOTONIC nanosecond intervals kept in a ring buffer in shared
+ * memory, so forked children (redirects, exec) record into the same buffer
+ * as the shell. The buffer is written out as Chrome trace JSON.
+ *
+ * When tracing is off the only cost is the test of trace_enabled.
+ */
+
+typedef enum {
+    TRACE_READ,
+    TRACE_PARSE,
+    TRACE_PARSE_REDIRECTS,
+    TRACE_BUILTIN,
+    TRACE_FORK,
+    TRACE_REDIRECT_FILE,
+    TRACE_EXEC,
+    TRACE_WAIT,
+    TRACE_REAP,
+} trace_stage_t;
+
+extern int trace_enabled;
+
+/* turns tracing on, allocating the ring buffer the first time,
+        returns 0 on success, -1 on failure */
+int trace_start(void);
+/* turns tracing off, the recorded events are kept */
+void trace_stop(void);
+
+/* returns the current CLOCK_MONOTONIC time in nanoseconds */
+uint64_t trace_now(void);
+
+/*
+ * records that stage ran from start_ns to end_ns in the calling process,
+ * label (may be NULL) is usually the command being run.
+ * end_ns == start_ns records an instant, e.g. the call to execv
+ */
+void trace_record(trace_stage_t stage, uint64_t start_ns, uint64_t end_ns,
+                  const char *label);
+
+/* start time for a stage, 0 when tracing is off */
+#define TRACE_BEGIN() (trace_enabled ? trace_now() : 0)
+/* records a stage that began at start, when tracing is on */
+#define TRACE_END(stage, start, label)                          \
+    do {                                                        \
+        if (trace_enabled) {                                    \
+            trace_record((stage), (start), trace_now(), (label)); \
+        }                                                       \
+    } while (0)
+
+/* writes the recorded events to path as Chrome trace JSON ("-" for stdout),
+        returns 0 on success, -1 on failure */
+int trace_dump(const char *path);
+
+#endif  // TRACE_H_
@@ -0,0 +1,398 @@
+#include "./vars.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./arith.h"
+
+#define ARENA_BLOCK 4096
+
+struct var {
+    char *name;  // NULL for an empty slot
+    char *value;
+    size_t value_cap;
+};
+typedef struct var var_t;
+
+// the expanded words of one command, freed all at once
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+typedef struct arena_block arena_block_t;
+
+int last_status = 0;
+
+// open addressing table, cap is a power of two and at most half full
+static var_t *vars = NULL;
+static size_t vars_cap = 0;
+static size_t vars_len = 0;
+
+static arena_block_t *arena = NULL;
+
+/* FNV-1a hash of the first len bytes of name */
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* returns the slot for name (length len), either its entry or an empty one */
+static var_t *find_slot(var_t *table, size_t cap, const char *name,
+                        size_t len) {
+    size_t i = (size_t)hash_name(name, len) & (cap - 1);
+    while (table[i].name != NULL) {
+        if (strncmp(table[i].name, name, len) == 0 &&
+            table[i].name[len] == '\0') {
+            break;
+        }
+        i = (i + 1) & (cap - 1);
+    }
+    return &table[i];
+}
+
+/* doubles the table, returns 0 on success, -1 on failure */
+static int grow_vars(void) {
+    size_t new_cap = vars_cap ? vars_cap * 2 : 64;
+    var_t *table = (var_t *)calloc(new_cap, sizeof(var_t));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < vars_cap; i++) {
+        if (vars[i].name != NULL) {
+            *find_slot(table, new_cap, vars[i].name, strlen(vars[i].name)) =
+                vars[i];
+        }
+    }
+    free(vars);
+    vars = table;
+    vars_cap = new_cap;
+    return 0;
+}
+
+/* sets a shell variable, returns 0 on success, -1 on failure */
+int set_var(const char *name, const char *value) {
+    if ((vars_len + 1) * 2 > vars_cap && grow_vars() == -1) {
+        perror("set_var");
+        return -1;
+    }
+
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    var_t *slot = find_slot(vars, vars_cap, name, name_len);
+    if (slot->name == NULL) {
+        slot->name = strdup(name);
+        slot->value = NULL;
+        slot->value_cap = 0;
+        vars_len++;
+    }
+
+    // loops assign the same variable over and over, reuse its buffer
+    if (value_len + 1 > slot->value_cap) {
+        size_t cap = value_len + 1 < 16 ? 16 : value_len + 1;
+        char *grown = (char *)realloc(slot->value, cap);
+        if (grown == NULL) {
+            perror("set_var");
+            return -1;
+        }
+        slot->value = grown;
+        slot->value_cap = cap;
+    }
+    memcpy(slot->value, value, value_len + 1);
+    return 0;
+}
+
+/* looks up a variable by the first len bytes of name, NULL if not set */
+static const char *get_var_len(const char *name, size_t len) {
+    if (vars_cap > 0) {
+        var_t *slot = find_slot(vars, vars_cap, name, len);
+        if (slot->name != NULL) {
+            return slot->value;
+        }
+    }
+
+    char env_name[256];
+    if (len >= sizeof(env_name)) {
+        return NULL;
+    }
+    memcpy(env_name, name, len);
+    env_name[len] = '\0';
+    return getenv(env_name);
+}
+
+/* gets a shell variable, falling back to the environment,
+        returns NULL if it is not set */
+const char *get_var(const char *name) {
+    return get_var_len(name, strlen(name));
+}
+
+/* returns 1 if str is a valid variable name, 0 otherwise */
+int is_var_name(const char *str, size_t len) {
+    if (len == 0 || (str[0] >= '0' && str[0] <= '9')) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = str[i];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * if word is an assignment (NAME=value) returns the position of the =,
+ * otherwise returns NULL
+ */
+char *find_assignment(const char *word) {
+    char *equals = strchr(word, '=');
+    if (equals == NULL || !is_var_name(word, (size_t)(equals - word))) {
+        return NULL;
+    }
+    return equals;
+}
+
+/* returns len bytes of memory from the expansion arena */
+static char *arena_alloc(size_t len) {
+    if (arena == NULL || arena->cap - arena->used < len) {
+        size_t cap = len > ARENA_BLOCK ? len : ARENA_BLOCK;
+        arena_block_t *block =
+            (arena_block_t *)malloc(sizeof(arena_block_t) + cap);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena;
+        block->used = 0;
+        block->cap = cap;
+        arena = block;
+    }
+    char *mem = &arena->data[arena->used];
+    arena->used += len;
+    return mem;
+}
+
+/* frees the strings made by expand_words */
+void reset_expansions(void) {
+    // keep one block around, most commands fit in it
+    while (arena != NULL && arena->next != NULL) {
+        arena_block_t *next = arena->next;
+        free(arena);
+        arena = next;
+    }
+    if (arena != NULL) {
+        arena->used = 0;
+    }
+}
+
+/* a growable string used while expanding one word */
+struct str_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+typedef struct str_buf str_buf_t;
+
+/* appends len bytes of str to buf, returns 0 on success, -1 on failure */
+static int buf_append(str_buf_t *buf, const char *str, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 64;
+        while (buf->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *grown = (char *)realloc(buf->data, cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(&buf->data[buf->len], str, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+/*
+ * expands the $ references in word into buf
+ * returns 0 on success, -1 on failure, -2 if a substitution is not closed
+ */
+static int expand_word(const char *word, str_buf_t *buf) {
+    buf->len = 0;
+    if (buf_append(buf, "", 0) == -1) {
+        return -1;
+    }
+
+    const char *cur = word;
+    while (*cur) {
+        const char *dollar = strchr(cur, '$');
+        if (dollar == NULL) {
+            return buf_append(buf, cur, strlen(cur));
+        }
+        if (buf_append(buf, cur, (size_t)(dollar - cur)) == -1) {
+            return -1;
+        }
+
+        const char *name = dollar + 1;
+        size_t len = 0;
+        const char *after;
+        char number[32];
+        const char *value = NULL;
+
+        if (strncmp(name, "((", 2) == 0) {
+            // $(( expression )), the )) that closes it is the first one
+            // outside any parentheses of the expression
+            const char *expr = name + 2;
+            const char *close = expr;
+            int parens = 0;
+            while (*close && !(parens == 0 && close[0] == ')' &&
+                               close[1] == ')')) {
+                if (*close == '(') {
+                    parens++;
+                } else if (*close == ')') {
+                    parens--;
+                }
+                close++;
+            }
+            long long result;
+            if (*close == '\0') {
+                fprintf(stderr, "%s: bad substitution \n", word);
+                return -2;
+            }
+            if (eval_arith(expr, (size_t)(close - expr), &result) == -1) {
+                return -1;
+            }
+            snprintf(number, sizeof(number), "%lld", result);
+            value = number;
+            after = close + 2;
+        } else if (*name == '?' || *name == '$') {
+            snprintf(number, sizeof(number), "%d",
+                     *name == '?' ? last_status : (int)getpid());
+            value = number;
+            after = name + 1;
+        } else if (*name == '{') {
+            const char *close = strchr(name, '}');
+            if (close == NULL ||
+                !is_var_name(name + 1, (size_t)(close - name - 1))) {
+                fprintf(stderr, "%s: bad substitution \n", word);
+                return -2;
+            }
+            value = get_var_len(name + 1, (size_t)(close - name - 1));
+            after = close + 1;
+        } else {
+            while (is_var_name(name, len + 1)) {
+                len++;
+            }
+            if (len == 0) {
+                // a $ that does not start a name is just a $
+                if (buf_append(buf, "$", 1) == -1) {
+                    return -1;
+                }
+                cur = name;
+                continue;
+            }
+            value = get_var_len(name, len);
+            after = name + len;
+        }
+
+        if (value != NULL && buf_append(buf, value, strlen(value)) == -1) {
+            return -1;
+        }
+        cur = after;
+    }
+    return 0;
+}
+
+/* expands word without splitting it, returns a string the caller frees,
+        NULL on failure */
+char *expand_string(const char *word) {
+    str_buf_t buf = {NULL, 0, 0};
+    if (expand_word(word, &buf) < 0) {
+        free(buf.data);
+        return NULL;
+    }
+    return buf.data;
+}
+
+/* returns 1 if word opens more parentheses than it closes */
+static int has_open_parens(const char *word) {
+    int parens = 0;
+    for (; *word; word++) {
+        if (*word == '(') {
+            parens++;
+        } else if (*word == ')') {
+            parens--;
+        }
+    }
+    return parens > 0;
+}
+
+/*
+ * expands the NULL-terminated words into out, at most max_out words. Words
+ * with a $ are expanded and split on whitespace like an unquoted expansion,
+ * so one word can become several or none.
+ * The expanded strings stay valid until the next reset_expansions.
+ * returns the number of words in out, which is also NULL-terminated, -1 if
+ * an expansion failed (e.g. a division by zero) and -2 if a substitution
+ * is not closed, after printing an error
+ */
+int expand_words(char *words[], char *out[], int max_out) {
+    static str_buf_t buf = {NULL, 0, 0};
+    static str_buf_t joined = {NULL, 0, 0};
+    int n_out = 0;
+
+    for (int i = 0; words[i] != NULL && n_out < max_out; i++) {
+        if (strchr(words[i], '$') == NULL) {
+            out[n_out++] = words[i];
+            continue;
+        }
+
+        const char *word = words[i];
+        if (strstr(word, "$((") != NULL && has_open_parens(word)) {
+            // the line was split on spaces, so $(( 1 + 2 )) arrives as
+            // several words, put them back together
+            joined.len = 0;
+            int failed = buf_append(&joined, word, strlen(word)) == -1;
+            while (!failed && words[i + 1] != NULL &&
+                   has_open_parens(joined.data)) {
+                i++;
+                failed = buf_append(&joined, " ", 1) == -1 ||
+                         buf_append(&joined, words[i], strlen(words[i])) == -1;
+            }
+            if (failed) {
+                perror("expand");
+                return -1;
+            }
+            word = joined.data;
+        }
+
+        // the command must not run with a word missing
+        int err = expand_word(word, &buf);
+        if (err < 0) {
+            return err;
+        }
+        char *copy = arena_alloc(buf.len + 1);
+        if (copy == NULL) {
+            perror("expand");
+            return -1;
+        }
+        memcpy(copy, buf.data, buf.len + 1);
+
+        char *save;
+        for (char *field = strtok_r(copy, " \t\n", &save);
+             field != NULL && n_out < max_out;
+             field = strtok_r(NULL, " \t\n", &save)) {
+            out[n_out++] = field;
+        }
+    }
+
+    out[n_out] = NULL;
+    return n_out;
+}
@@ -0,0 +1,45 @@
+#ifndef VARS_H_
+#define VARS_H_
+
+#include <stddef.h>
+
+/*
+ * shell variables and the expansion of $NAME, ${NAME}, $?, $$ and $(( )) in
+ * words
+ */
+
+/* exit status of the last command, expanded by $? */
+extern int last_status;
+
+/* sets a shell variable, returns 0 on success, -1 on failure */
+int set_var(const char *name, const char *value);
+/* gets a shell variable, falling back to the environment,
+        returns NULL if it is not set */
+const char *get_var(const char *name);
+
+/* returns 1 if str is a valid variable name, 0 otherwise */
+int is_var_name(const char *str, size_t len);
+/*
+ * if word is an assignment (NAME=value) returns the position of the =,
+ * otherwise returns NULL
+ */
+char *find_assignment(const char *word);
+
+/*
+ * expands the NULL-terminated words into out, at most max_out words. Words
+ * with a $ are expanded and split on whitespace like an unquoted expansion,
+ * so one word can become several or none.
+ * The expanded strings stay valid until the next reset_expansions.
+ * returns the number of words in out, which is also NULL-terminated, -1 if
+ * an expansion failed (e.g. a division by zero) and -2 if a substitution
+ * is not closed, after printing an error
+ */
+int expand_words(char *words[], char *out[], int max_out);
+/* frees the strings made by expand_words */
+void reset_expansions(void);
+
+/* expands word without splitting it, returns a string the caller frees,
+        NULL on failure */
+char *expand_string(const char *word);
+
+#endif  // VARS_H_
@@ -0,0 +1,312 @@
+#include "./watch.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./events.h"
+
+// what counts as a change, a file given directly is watched for the same
+// things happening to itself
+#define DIR_EVENTS                                                       \
+    (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+     IN_MOVED_TO)
+#define FILE_EVENTS \
+    (IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// one inotify watch
+struct watched {
+    char *path;  // NULL if the slot is unused
+    int root;    // 1 for a path given to watch_open
+};
+typedef struct watched watched_t;
+
+struct watch {
+    int fd;
+    watched_t *slots;  // indexed by watch descriptor, which are small
+    int slots_len;
+    int n_watched;
+    int pending;  // 1 if something changed since the last watch_settled
+    uint64_t last_change_ns;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* records that wd watches path, returns 0 on success, -1 on failure */
+static int set_slot(watch_t *watch, int wd, const char *path, int root) {
+    if (wd >= watch->slots_len) {
+        int new_len = watch->slots_len ? watch->slots_len : 256;
+        while (new_len <= wd) {
+            new_len *= 2;
+        }
+        watched_t *grown = (watched_t *)realloc(
+            watch->slots, sizeof(watched_t) * (size_t)new_len);
+        if (grown == NULL) {
+            perror("watch");
+            return -1;
+        }
+        memset(&grown[watch->slots_len], 0,
+               sizeof(watched_t) * (size_t)(new_len - watch->slots_len));
+        watch->slots = grown;
+        watch->slots_len = new_len;
+    }
+
+    watched_t *slot = &watch->slots[wd];
+    if (slot->path == NULL) {
+        watch->n_watched++;
+    } else {
+        // the same directory again, e.g. moved within the tree
+        root |= slot->root;
+        free(slot->path);
+    }
+    slot->path = strdup(path);
+    slot->root = root;
+    return 0;
+}
+
+/*
+ * adds a watch for the directory path and everything below it, path is a
+ * buffer of PATH_MAX bytes that is appended to and restored.
+ * returns 0 on success (paths that vanish or cannot be read are skipped),
+ * -1 if the watch limit was reached
+ */
+static int add_tree(watch_t *watch, char path[PATH_MAX], size_t len,
+                    int root) {
+    int wd = inotify_add_watch(watch->fd, path,
+                               DIR_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            fprintf(stderr,
+                    "watch: too many directories, see "
+                    "/proc/sys/fs/inotify/max_user_watches \n");
+            return -1;
+        }
+        return 0;
+    }
+    if (set_slot(watch, wd, path, root) == -1) {
+        return -1;
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    int err = 0;
+    struct dirent *entry;
+    while (err == 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        size_t name_len = strlen(entry->d_name);
+        if (len + 1 + name_len >= PATH_MAX) {
+            continue;
+        }
+        path[len] = '/';
+        memcpy(&path[len + 1], entry->d_name, name_len + 1);
+
+        // only directories need a watch of their own, d_type saves a stat
+        // per file on most file systems
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            err = add_tree(watch, path, len + 1 + name_len, 0);
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return err;
+}
+
+/* adds a watch for path, recursively if it is a directory, returns 0 on
+        success, -1 if path is gone or after printing an error */
+static int add_path(watch_t *watch, char path[PATH_MAX], size_t len,
+                    int root) {
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return add_tree(watch, path, len, root);
+    }
+
+    int wd = inotify_add_watch(watch->fd, path, FILE_EVENTS);
+    if (wd == -1) {
+        fprintf(stderr, "watch: %s: %s \n", path, strerror(errno));
+        return -1;
+    }
+    return set_slot(watch, wd, path, root);
+}
+
+/* reads the inotify events, run by the event loop */
+static void watch_read(int fd, void *data) {
+    watch_t *watch = (watch_t *)data;
+    char buffer[64 * 1024]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[PATH_MAX];
+
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+        char *pos = buffer;
+        while (pos < &buffer[got]) {
+            struct inotify_event *event = (struct inotify_event *)(void *)pos;
+            pos += sizeof(struct inotify_event) + event->len;
+
+            watched_t *slot = event->wd >= 0 && event->wd < watch->slots_len &&
+                                      watch->slots[event->wd].path != NULL
+                                  ? &watch->slots[event->wd]
+                                  : NULL;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost, so assume something changed
+                watch->pending = 1;
+                watch->last_change_ns = now_ns();
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // the watch is gone (deleted, or a file replaced by a
+                // rename), a path given to watch_open is looked up again
+                if (slot != NULL) {
+                    int root = slot->root;
+                    size_t len = strlen(slot->path);
+                    memcpy(path, slot->path, len + 1);
+                    free(slot->path);
+                    slot->path = NULL;
+                    watch->n_watched--;
+                    if (root && add_path(watch, path, len, 1) == 0) {
+                        watch->pending = 1;
+                        watch->last_change_ns = now_ns();
+                    }
+                }
+                continue;
+            }
+            if (event->len > 0 && event->name[0] == '.') {
+                continue;
+            }
+
+            if ((event->mask & IN_ISDIR) &&
+                (event->mask & (IN_CREATE | IN_MOVED_TO)) && slot != NULL) {
+                size_t len = strlen(slot->path);
+                size_t name_len = strlen(event->name);
+                if (len + 1 + name_len < PATH_MAX) {
+                    memcpy(path, slot->path, len);
+                    path[len] = '/';
+                    memcpy(&path[len + 1], event->name, name_len + 1);
+                    add_tree(watch, path, len + 1 + name_len, 0);
+                }
+            }
+            watch->pending = 1;
+            watch->last_change_ns = now_ns();
+        }
+    }
+}
+
+/*
+ * starts watching the n_paths paths, recursively.
+ * returns NULL after printing an error on failure
+ */
+watch_t *watch_open(char *paths[], int n_paths) {
+    watch_t *watch = (watch_t *)malloc(sizeof(watch_t));
+    if (watch == NULL) {
+        perror("watch");
+        return NULL;
+    }
+    watch->slots = NULL;
+    watch->slots_len = 0;
+    watch->n_watched = 0;
+    watch->pending = 0;
+    watch->last_change_ns = 0;
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd == -1) {
+        perror("watch: inotify_init1");
+        free(watch);
+        return NULL;
+    }
+
+    char path[PATH_MAX];
+    for (int i = 0; i < n_paths; i++) {
+        size_t len = strlen(paths[i]);
+        // a trailing / would be doubled when names are appended
+        while (len > 1 && paths[i][len - 1] == '/') {
+            len--;
+        }
+        if (len >= PATH_MAX) {
+            fprintf(stderr, "watch: %s: path too long \n", paths[i]);
+            watch_close(watch);
+            return NULL;
+        }
+        memcpy(path, paths[i], len);
+        path[len] = '\0';
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            fprintf(stderr, "watch: %s: %s \n", paths[i], strerror(errno));
+            watch_close(watch);
+            return NULL;
+        }
+        if (add_path(watch, path, len, 1) == -1) {
+            watch_close(watch);
+            return NULL;
+        }
+    }
+
+    if (add_event(watch->fd, watch_read, watch) == -1) {
+        perror("watch");
+        watch_close(watch);
+        return NULL;
+    }
+    return watch;
+}
+
+/* stops watching and frees the watch */
+void watch_close(watch_t *watch) {
+    if (watch == NULL) {
+        return;
+    }
+    // closing the descriptor removes every watch at once
+    remove_event(watch->fd);
+    close(watch->fd);
+    for (int i = 0; i < watch->slots_len; i++) {
+        free(watch->slots[i].path);
+    }
+    free(watch->slots);
+    free(watch);
+}
+
+/* returns the number of directories and files being watched */
+int watch_count(watch_t *watch) { return watch->n_watched; }
+
+/*
+ * returns 1 once something has changed and nothing else has for
+ * debounce_ms milliseconds, and forgets the changes. Otherwise returns 0
+ * and sets *timeout_ms to how long to wait before asking again (-1 while
+ * nothing has changed)
+ */
+int watch_settled(watch_t *watch, int debounce_ms, int *timeout_ms) {
+    if (!watch->pending) {
+        *timeout_ms = -1;
+        return 0;
+    }
+
+    uint64_t quiet_ns = now_ns() - watch->last_change_ns;
+    uint64_t debounce_ns = (uint64_t)debounce_ms * 1000000;
+    if (quiet_ns >= debounce_ns) {
+        watch->pending = 0;
+        return 1;
+    }
+    // rounded up, so the next call is not too early
+    *timeout_ms = (int)((debounce_ns - quiet_ns + 999999) / 1000000);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+/*
+ * change notification for the watch builtin. A watch is one inotify
+ * descriptor in the shell's event loop with a watch on every directory
+ * under the given paths (files given directly are watched themselves), so
+ * a tree costs one watch per directory rather than per file. Directories
+ * created or moved in later are added as they appear. Hidden names (.git,
+ * editor swap files) are skipped.
+ */
+
+// how long nothing must change before the command is run again
+#define WATCH_DEBOUNCE_MS 100
+// how long a run that is cancelled gets to exit before SIGKILL
+#define WATCH_GRACE_MS 2000
+
+typedef struct watch watch_t;
+
+/*
+ * starts watching the n_paths paths, recursively.
+ * returns NULL after printing an error on failure
+ */
+watch_t *watch_open(char *paths[], int n_paths);
+/* stops watching and frees the watch */
+void watch_close(watch_t *watch);
+
+/* returns the number of directories and files being watched */
+int watch_count(watch_t *watch);
+
+/*
+ * returns 1 once something has changed and nothing else has for
+ * debounce_ms milliseconds, and forgets the changes. Otherwise returns 0
+ * and sets *timeout_ms to how long to wait before asking again (-1 while
+ * nothing has changed)
+ */
+int watch_settled(watch_t *watch, int debounce_ms, int *timeout_ms);
+
+#endif  // WATCH_H_